@@ -8,17 +8,98 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/inotify.h>
+#include <sys/syscall.h>
+#endif
+
+// The first account number handed out
+#define FIRST_ACCOUNT_NUMBER 100
 
 // Global variable for generating unique account numbers
 // Starts from 100 and increments for new accounts if no recycled numbers are available.
-int globalNextAccountNumber = 100;
+int globalNextAccountNumber = FIRST_ACCOUNT_NUMBER;
+
+// Stream that all banking output is written to.
+// The console session uses stdout; in server mode each worker thread points it at the
+// output buffer of the connection it is currently running.
+_Thread_local FILE *bankOut;
+
+// Serialises access to the account book.
+// Sessions only hold it while a command executes, never while waiting for input.
+pthread_mutex_t bankLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Account types and their policies, one row per type. The AccountType enum, the names used
+// by commands and reports and the policy table below are all generated from these rows, so a
+// new type is one more row. The columns are:
+//   X(enum constant, name in commands and reports, label in messages,
+//     minimum balance, overdraft limit, withdrawal fee, annual interest rate in percent,
+//     balance below which LOWBALANCE lists the account)
+// A withdrawal and its fee must leave at least the minimum balance less the overdraft limit.
+#define ACCOUNT_TYPES(X) \
+    X(SAVINGS, "savings", "Savings", 100, 0, 0, 4.0, 100) \
+    X(CURRENT, "current", "Current", 0, 0, 0, 0.0, 100)
 
 // Enum to define account types
 typedef enum AccountType {
-    SAVINGS,  // Represents a savings account
-    CURRENT   // Represents a current account
+#define ACCOUNT_TYPE_ENUM(type, name, label, minimum, overdraft, fee, interest, lowBalance) type,
+    ACCOUNT_TYPES(ACCOUNT_TYPE_ENUM)
+#undef ACCOUNT_TYPE_ENUM
+    ACCOUNT_TYPE_COUNT
 } AccountType;
 
+// Policy of an account type, indexed by AccountType. Checks look their limits up here rather
+// than branch on the type, so the hot path is the same however many types there are.
+typedef struct AccountPolicy {
+    const char *name;           // Name in commands and reports ("savings")
+    const char *label;          // Name in messages ("Savings")
+    float minimumBalance;
+    float overdraftLimit;
+    float withdrawalFee;
+    double annualInterest;      // Percent a year on the average balance (see accrueInterest())
+    float lowBalance;           // LOWBALANCE lists accounts with a balance below this
+    float withdrawalFloor;      // Lowest balance a withdrawal may leave: minimum less overdraft
+    const char *belowMinimumText;   // Reasons for rejecting a withdrawal (see transactionResultText())
+    const char *overdrawnText;
+} AccountPolicy;
+
+const AccountPolicy accountPolicies[ACCOUNT_TYPE_COUNT] = {
+#define ACCOUNT_TYPE_POLICY(type, name, label, minimum, overdraft, fee, interest, lowBalance) \
+    [type] = {name, label, minimum, overdraft, fee, interest, lowBalance, (float)(minimum) - (float)(overdraft), \
+              "below " name " minimum balance", "would overdraw " name " account"},
+    ACCOUNT_TYPES(ACCOUNT_TYPE_POLICY)
+#undef ACCOUNT_TYPE_POLICY
+};
+
+// The type names as offered by the prompts ("savings/current") and listed in errors
+// ("'savings', 'current'"). Each row adds a separator and a name; the first separator is skipped.
+#define ACCOUNT_TYPE_CHOICE(type, name, label, minimum, overdraft, fee, interest, lowBalance) "/" name
+#define ACCOUNT_TYPE_QUOTED(type, name, label, minimum, overdraft, fee, interest, lowBalance) ", '" name "'"
+const char *const accountTypeChoices = ACCOUNT_TYPES(ACCOUNT_TYPE_CHOICE) + 1;
+const char *const accountTypeList = ACCOUNT_TYPES(ACCOUNT_TYPE_QUOTED) + 2;
+#undef ACCOUNT_TYPE_CHOICE
+#undef ACCOUNT_TYPE_QUOTED
+
 // Structure for account details (AccountNode)
 // Forms a node in a linked list of bank accounts.
 typedef struct Node {
@@ -26,6 +107,12 @@ typedef struct Node {
     char *Name;               // Name of the account holder (dynamically allocated)
     AccountType accountType;  // Type of the account (SAVINGS or CURRENT)
     float Amount;             // Current balance in the account
+    uint64_t keyHash;         // Hash of number, name and type (see accountKeyHash())
+    char *displayRow;         // Cached DISPLAY line for this account (see accountDisplayRow())
+    unsigned short displayRowLength;    // Length of displayRow
+    unsigned char displayRowTypeStart;  // Offset of the account type within displayRow
+    unsigned char displayRowTypeEnd;    // Offset just past the tabs that follow the account type
+    unsigned char displayRowValid;      // Cleared whenever name, type or balance change
     struct Node *next;        // Pointer to the next account in the list
 } AccountNode;
 
@@ -41,421 +128,6434 @@ typedef AccountNode *AccountList;
 // Typedef for a pointer to a DeletedAccountNumNode, representing the head of the deleted numbers list
 typedef DeletedAccountNumNode *DeletedAccountNumList;
 
-// Displays all accounts in the provided list.
-// If the list is empty, it prints a message indicating so.
-void display(AccountList l) {
-    if (l == NULL) {
-        printf("No Accounts to display\n");
-        return;
-    }
+// The account book shared by every session.
+AccountList accountsHead = NULL;                       // Head of the list for bank accounts
+DeletedAccountNumList deletedAccountNumbersHead = NULL; // Head of the list for recycled account numbers
+// The book is an ordered prefix that ends at orderedTail (NULL: nothing ordered yet), followed by
+// the accounts created since the last report. The book is in order when orderedTail is the last node.
+AccountNode *orderedTail = NULL;
 
-    char accountTypeStr[][20] = {
-        "savings",
-        "current"
-    };
+// Shared-memory read replica.
+// When enabled, every account is mirrored into a POSIX shared memory segment so that
+// separate reporting processes can read balances without touching the book or its lock.
+// A record lives in slot (AccountNumber - FIRST_ACCOUNT_NUMBER), so slots come out in
+// account number order. Each record carries a seqlock: the writer makes 'seq' odd while
+// it updates the record, and readers retry until they see the same even value before
+// and after copying it.
+#define REPLICA_MAGIC 0x424b5231u       // "BKR1"
+#define REPLICA_DEFAULT_CAPACITY (1u << 20)
+#define REPLICA_NAME_LEN 50
 
-    printf("Account Number\t\tAccount Type\t\tName                                              \t\t  Balance\n");
-    printf("--------------------------------------------------------------------------------------------------------------------------\n");
+typedef struct ReplicaRecord {
+    uint32_t seq;               // Seqlock sequence number (odd while being written)
+    int32_t accountNumber;      // Account number, or 0 if the slot is unused
+    int32_t accountType;        // AccountType of the account
+    float amount;               // Current balance
+    char name[REPLICA_NAME_LEN]; // Account holder's name
+} ReplicaRecord;
 
-    // Traverse the list and print details of each account
-    while (l != NULL) {
-        printf("%d\t\t\t%s\t\t\t%-50s\t\t%10.2f\n", l->AccountNumber, accountTypeStr[l->accountType], l->Name, l->Amount);
-        l = l->next;
-    }
-    printf("--------------------------------------------------------------------------------------------------------------------------\n");
+typedef struct ReplicaHeader {
+    uint32_t magic;             // REPLICA_MAGIC once the segment is initialised
+    uint32_t capacity;          // Number of record slots following the header
+    uint32_t highWater;         // All used slots are below this index
+} ReplicaHeader;
+
+ReplicaHeader *replica = NULL;   // Mapped segment of the writer, NULL when publishing is off
+ReplicaRecord *replicaRecords = NULL;
+char replicaName[64];           // Name of the segment, unlinked at exit
+
+// Returns the number of bytes a replica segment with 'capacity' slots occupies.
+size_t replicaSize(uint32_t capacity) {
+    return sizeof(ReplicaHeader) + (size_t)capacity * sizeof(ReplicaRecord);
 }
 
-// Adds a deleted account number to the list of recyclable numbers.
-// Allocates a new node for the number and appends it to the end of the list.
-DeletedAccountNumList addDeletedAccountNum(DeletedAccountNumList list, int accountNumToAdd) {
-    DeletedAccountNumNode *new_node = (DeletedAccountNumNode *)malloc(sizeof(DeletedAccountNumNode));
-    if (!new_node) {
-        perror("Failed to allocate memory for new deleted account number node");
-        return list; // Return original list on allocation failure
+// Creates (or replaces) the shared memory segment and starts publishing into it.
+// Returns 1 on success, 0 on failure.
+int replicaOpen(const char *name, uint32_t capacity) {
+    snprintf(replicaName, sizeof(replicaName), "%s%s", name[0] == '/' ? "" : "/", name);
+    int fd = shm_open(replicaName, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("Failed to create replica shared memory");
+        return 0;
     }
-    new_node->AccountNum = accountNumToAdd;
-    new_node->next = NULL;
-
-    // If the list is empty, the new node becomes the head
-    if (list == NULL) {
-        return new_node;
+    // The segment is sparse: pages are only backed once a slot in them is written
+    if (ftruncate(fd, (off_t)replicaSize(capacity)) < 0) {
+        perror("Failed to size replica shared memory");
+        close(fd);
+        shm_unlink(replicaName);
+        return 0;
     }
+    void *mem = mmap(NULL, replicaSize(capacity), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) {
+        perror("Failed to map replica shared memory");
+        shm_unlink(replicaName);
+        return 0;
+    }
+    replica = (ReplicaHeader *)mem;
+    replicaRecords = (ReplicaRecord *)(replica + 1);
+    replica->capacity = capacity;
+    replica->highWater = 0;
+    __atomic_store_n(&replica->magic, REPLICA_MAGIC, __ATOMIC_RELEASE);
+    return 1;
+}
 
-    // Traverse to the end of the list and append the new node
-    DeletedAccountNumNode *current = list;
-    while (current->next != NULL) {
-        current = current->next;
+// Stops publishing and removes the segment name; readers keep their mapping.
+void replicaClose(void) {
+    if (replica == NULL) {
+        return;
     }
-    current->next = new_node;
-    return list;
+    munmap(replica, replicaSize(replica->capacity));
+    shm_unlink(replicaName);
+    replica = NULL;
+    replicaRecords = NULL;
 }
 
-// Sorts the list of deleted account numbers in ascending order.
-// Uses a selection sort algorithm. This helps in reusing the smallest available account number first.
-DeletedAccountNumList sortDeletedAccountNumList(DeletedAccountNumList list) {
-    if (list == NULL || list->next == NULL) {
-        return list; // Already sorted or empty, no need to sort
+// Returns the replica record for an account number, or NULL if it has no slot.
+ReplicaRecord *replicaSlot(int accountNumber) {
+    if (replica == NULL) {
+        return NULL;
     }
-    DeletedAccountNumNode *current = list;
-    while (current != NULL) {
-        DeletedAccountNumNode *minNode = current;
-        DeletedAccountNumNode *runner = current->next;
-        // Find the node with the minimum account number in the rest of the list
-        while (runner != NULL) {
-            if (runner->AccountNum < minNode->AccountNum) {
-                minNode = runner;
-            }
-            runner = runner->next;
-        }
-        // Swap the account numbers if a smaller one is found
-        if (minNode != current) {
-            int temp = current->AccountNum;
-            current->AccountNum = minNode->AccountNum;
-            minNode->AccountNum = temp;
-        }
-        current = current->next;
+    uint32_t slot = (uint32_t)(accountNumber - FIRST_ACCOUNT_NUMBER);
+    if (accountNumber < FIRST_ACCOUNT_NUMBER || slot >= replica->capacity) {
+        return NULL; // Beyond the segment; the account is simply not replicated
     }
-    return list;
+    if (slot >= replica->highWater) {
+        __atomic_store_n(&replica->highWater, slot + 1, __ATOMIC_RELEASE);
+    }
+    return &replicaRecords[slot];
 }
 
-// Creates a new bank account and adds it to the account list.
-// It reuses an account number from the deleted list if available, otherwise generates a new one.
-AccountList createAccount(DeletedAccountNumList *deletedNumsListHead, AccountList list, AccountType accountType, const char *Name, float Amount) {
-    AccountNode *new_node = (AccountNode *)malloc(sizeof(AccountNode));
-    if (!new_node) {
-        perror("Failed to allocate memory for new account node");
-        return list; // Return original list on allocation failure
+// Opens the seqlock of a record for writing (makes the sequence odd).
+void replicaBeginWrite(ReplicaRecord *r) {
+    __atomic_store_n(&r->seq, r->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+// Closes the seqlock of a record (makes the sequence even again).
+void replicaEndWrite(ReplicaRecord *r) {
+    __atomic_store_n(&r->seq, r->seq + 1, __ATOMIC_RELEASE);
+}
+
+// Publishes every field of an account, used when it is created.
+void replicaPublishAccount(AccountNode *node) {
+    ReplicaRecord *r = replicaSlot(node->AccountNumber);
+    if (r == NULL) {
+        return;
     }
-    new_node->accountType = accountType;
-    new_node->Name = strdup(Name); // Duplicate the name string
-    if (!new_node->Name) {
-        perror("Failed to allocate memory for account name");
-        free(new_node); // Free the allocated AccountNode
-        return list;    // Return original list on allocation failure
+    replicaBeginWrite(r);
+    r->accountNumber = node->AccountNumber;
+    r->accountType = node->accountType;
+    r->amount = node->Amount;
+    strncpy(r->name, node->Name, REPLICA_NAME_LEN - 1);
+    r->name[REPLICA_NAME_LEN - 1] = '\0';
+    replicaEndWrite(r);
+}
+
+// Publishes a new balance: two sequence stores around one amount store.
+void replicaPublishBalance(AccountNode *node) {
+    ReplicaRecord *r = replicaSlot(node->AccountNumber);
+    if (r == NULL) {
+        return;
     }
-    new_node->Amount = Amount;
+    replicaBeginWrite(r);
+    r->amount = node->Amount;
+    replicaEndWrite(r);
+}
 
-    // Assign account number:
-    // 1. Try to recycle from the sorted list of deleted account numbers.
-    // 2. If no recycled numbers, generate a new one using globalNextAccountNumber.
-    if (*deletedNumsListHead != NULL) {
-        new_node->AccountNumber = (*deletedNumsListHead)->AccountNum;
-        DeletedAccountNumNode *temp = *deletedNumsListHead;
-        *deletedNumsListHead = (*deletedNumsListHead)->next; // Remove the used number from the list
-        free(temp); // Free the node of the recycled number
-    } else {
-        new_node->AccountNumber = globalNextAccountNumber++; // Use global counter and increment
+// Marks the slot of a deleted account as unused.
+void replicaRemove(int accountNumber) {
+    ReplicaRecord *r = replicaSlot(accountNumber);
+    if (r == NULL) {
+        return;
     }
+    replicaBeginWrite(r);
+    r->accountNumber = 0;
+    replicaEndWrite(r);
+}
 
-    new_node->next = NULL;
+// Write-ahead log.
+// With --wal <dir>, every change to the book is appended to <dir>/bank.wal as one text
+// line and flushed to the operating system before the command's reply is written.
+// The log is replayed on startup and tailed by a standby process (see runStandby()).
+// Record formats (timestamps are microseconds of wall-clock time):
+//   C <time> <number> <type> <amount> <name>   account created
+//   B <time> <number> <amount>                 balance changed
+//   D <time> <number>                          account deleted
+//   A <time>                                   interest accrued: every interest period restarts
+//   L <time> <number> <principal> <rate> <EMI> loan granted to an account (paise; rate in 2^-24)
+//   P <time> <loan> <principal>                installment paid on a loan: the principal left
+#define WAL_FILE_NAME "bank.wal"
 
-    printf("Account Created Successfully\n");
-    printf("Account Number: %d\n", new_node->AccountNumber);
-    printf("Account Holder: %s\n", new_node->Name);
-    printf("Account Type: %s\n", accountType == SAVINGS ? "savings" : "current");
-    printf("Balance: Rs %.2f\n\n", new_node->Amount);
+FILE *walFile = NULL; // Log being appended to, NULL when logging is off
 
-    // If the account list is empty, the new node becomes the head
-    if (list == NULL) {
-        return new_node;
-    }
+// Returns the current wall-clock time in microseconds.
+long long nowMicros(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
 
-    // Traverse to the end of the account list and append the new node
-    AccountNode *current = list;
-    while (current->next != NULL) {
-        current = current->next;
+// Timestamp of the log record being applied by recovery or a standby, 0 otherwise.
+long long walReplayMicros = 0;
+
+// Returns the time of the change being made, in seconds since the epoch: the time of the log
+// record while one is replayed, so that recovery keeps when things happened, else now.
+uint32_t changeTime(void) {
+    return walReplayMicros > 0 ? (uint32_t)(walReplayMicros / 1000000) : (uint32_t)time(NULL);
+}
+
+// Appends an accrual run record. The interest itself follows as balance records.
+void walLogAccrual(void) {
+    if (walFile == NULL) {
+        return;
     }
-    current->next = new_node;
-    return list;
+    fprintf(walFile, "A %lld\n", nowMicros());
+    fflush(walFile);
 }
 
-// Deletes an account from the list based on account holder's name and account type.
-// The account number of the deleted account is returned via the deletedAccountNumber pointer.
-AccountList deleteAccount(AccountList list, AccountType accountType, const char *Name, int *deletedAccountNumber) {
-    AccountNode *current = list;
-    AccountNode *prev = NULL;
-    *deletedAccountNumber = -1; // Initialize to -1 (indicates account not found/deleted)
+// Appends a loan record. Its disbursal follows as a balance record.
+void walLogLoan(int accountNumber, long long principal, long long monthlyRate, long long emi) {
+    if (walFile == NULL) {
+        return;
+    }
+    fprintf(walFile, "L %lld %d %lld %lld %lld\n", nowMicros(), accountNumber, principal, monthlyRate, emi);
+    fflush(walFile);
+}
 
-    if (list == NULL) {
-        printf("No Accounts to delete\n");
-        return NULL;
+// Appends an installment record for loan number 'loan' (its index in the loan book).
+void walLogInstallment(long long loan, long long principal) {
+    if (walFile == NULL) {
+        return;
     }
+    fprintf(walFile, "P %lld %lld %lld\n", nowMicros(), loan, principal);
+    fflush(walFile);
+}
 
-    // Traverse the list to find the account to delete
-    while (current != NULL) {
-        if (strcmp(current->Name, Name) == 0 && current->accountType == accountType) {
-            *deletedAccountNumber = current->AccountNumber; // Capture the account number
+// Builds the path of the log file inside 'dir'.
+void walPath(char *path, size_t size, const char *dir) {
+    snprintf(path, size, "%s/%s", dir, WAL_FILE_NAME);
+}
 
-            if (prev == NULL) { // Account to delete is the head node
-                list = current->next;
-            } else { // Account to delete is in the middle or at the end
-                prev->next = current->next;
-            }
-            free(current->Name); // Free the dynamically allocated name
-            free(current);       // Free the account node itself
-            printf("Account deleted successfully! Account Number: %d\n", *deletedAccountNumber);
-            return list; // Return the modified list
-        }
-        prev = current;
-        current = current->next;
+// Opens the log in 'dir' for appending. Returns 1 on success, 0 on failure.
+int walOpenForAppend(const char *dir) {
+    char path[512];
+    walPath(path, sizeof(path), dir);
+    walFile = fopen(path, "a");
+    if (!walFile) {
+        perror("Failed to open write-ahead log");
+        return 0;
     }
+    return 1;
+}
 
-    // If the loop completes, the account was not found
-    printf("Invalid: Account '%s' of type %s does not exist for deletion\n", Name, accountType == SAVINGS ? "savings" : "current");
-    return list; // Return original list if not found
+// Closes the log if it is open.
+void walClose(void) {
+    if (walFile != NULL) {
+        fclose(walFile);
+        walFile = NULL;
+    }
 }
 
-// Displays accounts with a balance less than Rs 100.00.
-void lowBalanceAccounts(AccountList l) {
-    if (l == NULL) {
-        printf("No Accounts to display\n");
+// Logs the creation of an account.
+void walLogCreate(AccountNode *node) {
+    if (walFile == NULL) {
         return;
     }
-    int foundLowBalance = 0; // Flag to check if any low balance account is found
-    printf("Accounts with balance less than Rs 100.00:\n");
-    printf("Account Number\t\tName                                              \t\t     Balance\n");
-    printf("----------------------------------------------------------------------------------------------------\n");
+    fprintf(walFile, "C %lld %d %d %.9g %s\n", nowMicros(), node->AccountNumber, (int)node->accountType, node->Amount, node->Name);
+    fflush(walFile);
+}
 
-    // Traverse the list and print details of low balance accounts
-    while (l != NULL) {
-        if (l->Amount < 100) {
-            printf("%d\t\t\t%-50s\t\t%10.2f\n", l->AccountNumber, l->Name, l->Amount);
-            foundLowBalance = 1;
-        }
-        l = l->next;
+// Logs the new balance of an account.
+void walLogBalance(AccountNode *node) {
+    if (walFile == NULL) {
+        return;
     }
-    if (!foundLowBalance) {
-        printf("No accounts found with balance less than Rs 100.00\n");
+    fprintf(walFile, "B %lld %d %.9g\n", nowMicros(), node->AccountNumber, node->Amount);
+    fflush(walFile);
+}
+
+// Logs the deletion of an account.
+void walLogDelete(int accountNumber) {
+    if (walFile == NULL) {
+        return;
     }
-    printf("----------------------------------------------------------------------------------------------------\n");
+    fprintf(walFile, "D %lld %d\n", nowMicros(), accountNumber);
+    fflush(walFile);
 }
 
-// Performs a transaction (deposit or withdrawal) on a specified account.
-// 'code = 1' for deposit, 'code = 0' for withdrawal.
-AccountList transaction(AccountList list, int transactionAccountNumber, float amount, int code) {
-    AccountNode *current = list;
-    int accountFound = 0; // Flag to check if the account for transaction exists
+// State fingerprint of the book.
+// The fingerprint is the sum of a 64-bit hash per (AccountNumber, Name, accountType,
+// Amount) tuple, so it does not depend on the order of the list and every change can
+// be applied in O(1): subtract the account's old hash, add its new one.
+uint64_t bookFingerprint = 0;
 
-    if (list == NULL) {
-        printf("No Accounts to display for transactions\n");
-        return list;
+// Mixes a 64-bit value (the splitmix64 finaliser).
+uint64_t mix64(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+// Returns the hash of the parts of an account that never change: number, name and type.
+// It is computed once when the account is created and kept in node->keyHash. The number takes
+// the low 32 bits of the mixed word and the type the bits from ACCOUNT_KEY_TYPE_SHIFT up.
+#define ACCOUNT_KEY_TYPE_SHIFT 32
+
+uint64_t accountKeyHash(const AccountNode *node) {
+    uint64_t h = 0xcbf29ce484222325ULL; // FNV-1a over the name
+    for (const char *p = node->Name; *p; p++) {
+        h = (h ^ (unsigned char)*p) * 0x100000001b3ULL;
     }
+    return h ^ mix64((uint64_t)(uint32_t)node->AccountNumber | ((uint64_t)node->accountType << ACCOUNT_KEY_TYPE_SHIFT));
+}
 
-    // Traverse the list to find the account
-    while (current != NULL) {
-        if (current->AccountNumber == transactionAccountNumber) {
-            accountFound = 1;
-            if (code == 1) { // Deposit
-                current->Amount += amount;
-                printf("Deposit successful. Updated balance for account %d is Rs.%.2f\n", transactionAccountNumber, current->Amount);
-            } else if (code == 0) { // Withdrawal
-                // Check for minimum balance for SAVINGS account
-                if (current->accountType == SAVINGS && current->Amount - amount < 100) {
-                    printf("The balance is insufficient for the specified withdrawal (Minimum Rs 100.00 required for Savings)\n");
-                // Check for overdrawing for CURRENT account (balance cannot go below 0)
-                } else if (current->accountType == CURRENT && current->Amount - amount < 0) {
-                     printf("The balance is insufficient for the specified withdrawal (Cannot overdraw)\n");
-                }
-                else { // Sufficient balance for withdrawal
-                    current->Amount -= amount;
-                    printf("Withdrawal successful. Updated balance for account %d is Rs.%.2f\n", transactionAccountNumber, current->Amount);
-                }
-            } else { // Invalid transaction code
-                printf("Invalid Transaction Code (1 for deposit, 0 for withdrawal)\n");
-            }
-            return list; // Return after processing the transaction
-        }
-        current = current->next;
+// Returns the hash of an account as if its balance were 'amount'.
+uint64_t accountHashWithAmount(const AccountNode *node, float amount) {
+    uint32_t amountBits;
+    memcpy(&amountBits, &amount, sizeof(amountBits));
+    return mix64(node->keyHash ^ ((uint64_t)amountBits << 1));
+}
+
+// Returns the hash of one account's contents.
+uint64_t accountHash(const AccountNode *node) {
+    return accountHashWithAmount(node, node->Amount);
+}
+
+// Returns the hash of the whole book.
+uint64_t stateHash(void) {
+    return bookFingerprint;
+}
+
+// Merkle tree over account number ranges.
+// Leaf i covers the MERKLE_LEAF_SPAN account numbers starting at
+// FIRST_ACCOUNT_NUMBER + i * MERKLE_LEAF_SPAN and holds the sum of their account hashes,
+// which every change adjusts in O(1). Interior hashes are only recomputed, along the
+// paths of dirty leaves, when someone asks for them (merkleRefresh()).
+#define MERKLE_LEAF_SPAN 64
+
+typedef struct MerkleTree {
+    uint32_t leafCapacity;      // Number of leaves, a power of two (0 = empty tree)
+    uint64_t *nodes;            // Heap layout: nodes[1] is the root, leaf i is nodes[leafCapacity + i]
+    uint32_t *dirtyLeaves;      // Leaves changed since the last refresh
+    uint32_t dirtyCount;        // Number of entries in dirtyLeaves
+    unsigned char *leafDirty;   // 1 if the leaf is already in dirtyLeaves
+    int rebuild;                // Recompute every interior node on the next refresh
+} MerkleTree;
+
+MerkleTree liveMerkle; // Tree over the live book
+
+// Combines the hashes of two children. Empty subtrees hash to 0 at every height.
+uint64_t merkleCombine(uint64_t left, uint64_t right) {
+    if (left == 0 && right == 0) {
+        return 0;
     }
+    return mix64(left ^ mix64(right + 0x9e3779b97f4a7c15ULL));
+}
 
-    // If the loop completes, the account was not found
-    if (!accountFound) {
-        printf("Invalid: Account with number %d does not exist for transaction\n", transactionAccountNumber);
+// Grows the tree to at least 'leaves' leaves. Returns 1 on success, 0 on failure.
+int merkleEnsureLeaves(MerkleTree *t, uint32_t leaves) {
+    if (leaves <= t->leafCapacity) {
+        return 1;
     }
-    return list;
+    uint32_t capacity = t->leafCapacity ? t->leafCapacity : 1;
+    while (capacity < leaves) {
+        capacity *= 2;
+    }
+    uint64_t *nodes = (uint64_t *)calloc(2 * (size_t)capacity, sizeof(uint64_t));
+    uint32_t *dirtyLeaves = (uint32_t *)malloc(capacity * sizeof(uint32_t));
+    unsigned char *leafDirty = (unsigned char *)calloc(capacity, 1);
+    if (!nodes || !dirtyLeaves || !leafDirty) {
+        perror("Failed to allocate memory for Merkle tree");
+        free(nodes);
+        free(dirtyLeaves);
+        free(leafDirty);
+        return 0;
+    }
+    if (t->leafCapacity > 0) {
+        memcpy(nodes + capacity, t->nodes + t->leafCapacity, t->leafCapacity * sizeof(uint64_t));
+    }
+    free(t->nodes);
+    free(t->dirtyLeaves);
+    free(t->leafDirty);
+    t->nodes = nodes;
+    t->dirtyLeaves = dirtyLeaves;
+    t->leafDirty = leafDirty;
+    t->leafCapacity = capacity;
+    t->dirtyCount = 0;
+    t->rebuild = 1; // The interior has a new shape
+    return 1;
 }
 
-// Sorts the account list by account number in ascending order.
-// Uses a selection sort algorithm.
-AccountList sortAccountListByNumber(AccountList list) {
-    if (list == NULL || list->next == NULL) {
-        return list; // Already sorted or empty
+// Releases the memory of a tree.
+void merkleFree(MerkleTree *t) {
+    free(t->nodes);
+    free(t->dirtyLeaves);
+    free(t->leafDirty);
+    memset(t, 0, sizeof(*t));
+}
+
+// Adds 'delta' to the leaf covering 'accountNumber' and marks it dirty.
+void merkleAdd(MerkleTree *t, int accountNumber, uint64_t delta) {
+    if (accountNumber < FIRST_ACCOUNT_NUMBER) {
+        return;
     }
-    AccountNode *current = list;
-    // Using a simple selection sort
-    while (current != NULL) {
-        AccountNode *minNode = current;
-        AccountNode *runner = current->next;
-        // Find the node with the minimum account number in the rest of the list
-        while (runner != NULL) {
-            if (runner->AccountNumber < minNode->AccountNumber) {
-                minNode = runner;
-            }
-            runner = runner->next;
+    uint32_t leaf = (uint32_t)(accountNumber - FIRST_ACCOUNT_NUMBER) / MERKLE_LEAF_SPAN;
+    if (!merkleEnsureLeaves(t, leaf + 1)) {
+        return;
+    }
+    t->nodes[t->leafCapacity + leaf] += delta;
+    if (!t->leafDirty[leaf] && !t->rebuild) {
+        t->leafDirty[leaf] = 1;
+        t->dirtyLeaves[t->dirtyCount++] = leaf;
+    }
+}
+
+// Brings the interior hashes up to date with the leaves.
+void merkleRefresh(MerkleTree *t) {
+    if (t->leafCapacity == 0) {
+        return;
+    }
+    if (t->rebuild) {
+        for (uint32_t i = t->leafCapacity - 1; i >= 1; i--) {
+            t->nodes[i] = merkleCombine(t->nodes[2 * i], t->nodes[2 * i + 1]);
         }
-        // Swap data of current node and minNode if they are different
-        // This swaps all account details: Number, Name, Type, Amount.
-        if (minNode != current) {
-            // Swap AccountNumber
-            int tempAccountNumber = current->AccountNumber;
-            current->AccountNumber = minNode->AccountNumber;
-            minNode->AccountNumber = tempAccountNumber;
-
-            // Swap Name (pointers)
-            char *tempName = current->Name;
-            current->Name = minNode->Name;
-            minNode->Name = tempName;
-
-            // Swap AccountType
-            AccountType tempAccountType = current->accountType;
-            current->accountType = minNode->accountType;
-            minNode->accountType = tempAccountType;
-
-            // Swap Amount
-            float tempAmount = current->Amount;
-            current->Amount = minNode->Amount;
-            minNode->Amount = tempAmount;
+        t->rebuild = 0;
+    } else {
+        for (uint32_t d = 0; d < t->dirtyCount; d++) {
+            for (uint32_t i = (t->leafCapacity + t->dirtyLeaves[d]) / 2; i >= 1; i /= 2) {
+                t->nodes[i] = merkleCombine(t->nodes[2 * i], t->nodes[2 * i + 1]);
+            }
         }
-        current = current->next;
     }
-    return list;
+    for (uint32_t d = 0; d < t->dirtyCount; d++) {
+        t->leafDirty[t->dirtyLeaves[d]] = 0;
+    }
+    t->dirtyCount = 0;
 }
 
-// Checks if an account with the given name and account type already exists in the list.
-// Returns 1 if a duplicate is found, 0 otherwise.
-int checkDuplicateAccount(AccountList list, const char *Name, AccountType accountType) {
-    AccountNode *current = list;
-    while (current != NULL) {
-        if (strcmp(current->Name, Name) == 0 && current->accountType == accountType) {
-            return 1; // Duplicate found
-        }
-        current = current->next;
+// Command recorder.
+// With --record <file>, every input token is written as "<microseconds> <session> <token>",
+// with time measured from the start of the recording. The book's state hash is written
+// as a "# start" line first and a "# end" line when the recording is closed, so that a
+// replay can check it reproduced the same state.
+FILE *recordFile = NULL;
+long long recordStart;
+pthread_mutex_t recordLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Returns a monotonic timestamp in nanoseconds.
+long long monotonicNanos(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Starts recording to 'path'. Returns 1 on success, 0 on failure.
+int recordOpen(const char *path) {
+    recordFile = fopen(path, "w");
+    if (!recordFile) {
+        perror("Failed to open recording");
+        return 0;
     }
-    return 0; // No duplicate
+    recordStart = monotonicNanos();
+    fprintf(recordFile, "# start %016llx\n", (unsigned long long)stateHash());
+    return 1;
 }
 
+// Appends one input token of a session to the recording. Call with recordLock held.
+void recordToken(unsigned sessionId, const char *token) {
+    fprintf(recordFile, "%lld %u %s\n", (monotonicNanos() - recordStart) / 1000, sessionId, token);
+}
 
-// Main function: Drives the bank management system.
-// Handles user input for various banking operations.
-int main() {
-    DeletedAccountNumList deletedAccountNumbersHead = NULL; // Head of the list for recycled account numbers
-    AccountList accountsHead = NULL;                       // Head of the list for bank accounts
+// Finishes the recording with the final state hash. Call with the book quiescent.
+void recordClose(void) {
+    if (recordFile == NULL) {
+        return;
+    }
+    fprintf(recordFile, "# end %016llx\n", (unsigned long long)stateHash());
+    fclose(recordFile);
+    recordFile = NULL;
+}
 
-    char commandInput[100];         // Buffer for user command
-    char accountTypeInputStr[20];   // Buffer for account type string ("savings"/"current")
-    AccountType accType;            // Variable for AccountType enum
-    float amountInput;              // Buffer for transaction/deposit amount
-    char nameInput[50];             // Buffer for account holder's name (max 49 chars + null terminator)
-    int targetAccountNumberInput;   // Buffer for account number in transactions
-    int transactionCodeInput;       // Buffer for transaction code (0 for withdrawal, 1 for deposit)
+// Memory arenas.
+// Account nodes, interned names and index chunks come from pools of fixed-size objects carved
+// out of 2 MB regions, so that a book of millions of accounts is spread over few pages and
+// random lookups miss the TLB less often. Regions are backed by explicit huge pages
+// (MAP_HUGETLB) when asked for and available, otherwise by ordinary pages that are advised
+// to become transparent huge pages, otherwise by ordinary pages (see --huge-pages).
+// Pools are not thread-safe: allocate and free with bankLock held.
+#define ARENA_REGION_SIZE ((size_t)2 << 20)
+#define NAME_SLOT_SIZE 64
 
-    printf("Bank Management System (q1.c enhanced)\n");
-    printf("Commands: CREATE, DELETE, DISPLAY, TRANSACTION, LOWBALANCE, EXIT\n");
+typedef enum PageMode {
+    PAGES_NORMAL,       // Ordinary pages
+    PAGES_THP,          // Ordinary pages advised to become transparent huge pages
+    PAGES_EXPLICIT      // Explicit huge pages, falling back to PAGES_THP
+} PageMode;
 
-    // Main command loop
-    while (1) {
-        printf("\nEnter command: ");
-        scanf("%s", commandInput); // Read the command
+PageMode pageMode = PAGES_THP;
 
-        // Exit command
-        if (strcmp(commandInput, "EXIT") == 0) {
-            printf("Exiting program. Goodbye!\n");
-            // Free allocated memory for accounts before exiting
-            AccountNode *currentAcc = accountsHead;
-            while (currentAcc != NULL) {
-                AccountNode *nextAcc = currentAcc->next;
-                free(currentAcc->Name); // Free the duplicated name string
-                free(currentAcc);       // Free the account node
-                currentAcc = nextAcc;
-            }
-            // Free allocated memory for deleted account numbers list
-            DeletedAccountNumNode *currentDel = deletedAccountNumbersHead;
-            while (currentDel != NULL) {
-                DeletedAccountNumNode *nextDel = currentDel->next;
-                free(currentDel); // Free the deleted account number node
-                currentDel = nextDel;
-            }
-            break; // Exit the loop and terminate the program
-        }
-        // Create account command
-        else if (strcmp(commandInput, "CREATE") == 0) {
-            printf("Enter account type (savings/current): ");
-            scanf("%s", accountTypeInputStr);
-            printf("Enter account holder's name: ");
-            scanf("%s", nameInput); // Note: scanf("%s") can lead to buffer overflow if input is too long.
-                                     // Consider using fgets for safer input.
-            printf("Enter initial deposit amount: ");
-            scanf("%f", &amountInput);
+typedef struct Pool {
+    size_t objectSize;          // Bytes per object, a multiple of 16
+    void *freeList;             // Freed objects, linked through their first word
+    char *bump;                 // Next never-used object of the newest region
+    char *bumpEnd;              // End of the newest region
+    void **regions;             // Every region of the pool
+    size_t regionCount;
+    size_t regionCapacity;
+    size_t hugeRegions;         // Regions backed by explicit huge pages
+    size_t adviseRegions;       // Regions advised to become transparent huge pages
+    long long inUse;            // Objects handed out and not freed
+} Pool;
 
-            // Convert account type string to enum
-            if (strcmp(accountTypeInputStr, "savings") == 0) {
-                accType = SAVINGS;
-            } else if (strcmp(accountTypeInputStr, "current") == 0) {
-                accType = CURRENT;
-            } else {
-                printf("Invalid Account Type: '%s'. Please use 'savings' or 'current'.\n", accountTypeInputStr);
-                continue; // Go to the next iteration of the loop
-            }
+Pool accountPool = {(sizeof(AccountNode) + 15) & ~(size_t)15, NULL, NULL, NULL, NULL, 0, 0, 0, 0, 0};
+Pool namePool = {NAME_SLOT_SIZE, NULL, NULL, NULL, NULL, 0, 0, 0, 0, 0};
+Pool indexPool = {0, NULL, NULL, NULL, NULL, 0, 0, 0, 0, 0}; // Sized by the index section
 
-            // Check for duplicate account before creating
-            if (checkDuplicateAccount(accountsHead, nameInput, accType)) {
-                printf("Invalid: Account for '%s' of type '%s' already exists.\n", nameInput, accountTypeInputStr);
-            } else {
-                // Sort deleted numbers list to ensure the smallest is used first for recycling
-                deletedAccountNumbersHead = sortDeletedAccountNumList(deletedAccountNumbersHead);
-                accountsHead = createAccount(&deletedAccountNumbersHead, accountsHead, accType, nameInput, amountInput);
-            }
+// Maps one 2 MB-aligned region with the current page mode. Returns NULL on failure.
+// *backing is set to the mode actually obtained.
+void *regionMap(PageMode *backing) {
+#ifdef MAP_HUGETLB
+    if (pageMode == PAGES_EXPLICIT) {
+        void *region = mmap(NULL, ARENA_REGION_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (region != MAP_FAILED) {
+            *backing = PAGES_EXPLICIT;
+            return region;
         }
-        // Delete account command
-        else if (strcmp(commandInput, "DELETE") == 0) {
-            printf("Enter account type to delete (savings/current): ");
-            scanf("%s", accountTypeInputStr);
-            printf("Enter account holder's name to delete: ");
-            scanf("%s", nameInput);
+    }
+#endif
+    // Over-allocate so that the region can start on a 2 MB boundary, as huge pages must
+    char *raw = (char *)mmap(NULL, 2 * ARENA_REGION_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) {
+        perror("Failed to map arena region");
+        return NULL;
+    }
+    char *region = (char *)(((uintptr_t)raw + ARENA_REGION_SIZE - 1) & ~(uintptr_t)(ARENA_REGION_SIZE - 1));
+    if (region > raw) {
+        munmap(raw, (size_t)(region - raw));
+    }
+    munmap(region + ARENA_REGION_SIZE, (size_t)(raw + 2 * ARENA_REGION_SIZE - (region + ARENA_REGION_SIZE)));
+    *backing = PAGES_NORMAL;
+#ifdef MADV_HUGEPAGE
+    if (pageMode != PAGES_NORMAL && madvise(region, ARENA_REGION_SIZE, MADV_HUGEPAGE) == 0) {
+        *backing = PAGES_THP;
+    }
+#endif
+    return region;
+}
 
-            // Convert account type string to enum
-            if (strcmp(accountTypeInputStr, "savings") == 0) {
-                accType = SAVINGS;
-            } else if (strcmp(accountTypeInputStr, "current") == 0) {
-                accType = CURRENT;
-            } else {
-                printf("Invalid Account Type: '%s'. Please use 'savings' or 'current'.\n", accountTypeInputStr);
-                continue; // Go to the next iteration of the loop
-            }
+// Converts a page mode name (none, thp or explicit). Returns 1 on success, 0 if unknown.
+int parsePageMode(const char *str, PageMode *mode) {
+    if (strcmp(str, "none") == 0) {
+        *mode = PAGES_NORMAL;
+    } else if (strcmp(str, "thp") == 0) {
+        *mode = PAGES_THP;
+    } else if (strcmp(str, "explicit") == 0) {
+        *mode = PAGES_EXPLICIT;
+    } else {
+        return 0;
+    }
+    return 1;
+}
 
-            int deletedNum = -1; // To store the account number of the deleted account
-            accountsHead = deleteAccount(accountsHead, accType, nameInput, &deletedNum);
-            if (deletedNum != -1) { // If an account was successfully deleted
-                deletedAccountNumbersHead = addDeletedAccountNum(deletedAccountNumbersHead, deletedNum);
-                // Success message is printed inside deleteAccount
+// Returns an uninitialised object from a pool, or NULL if memory ran out.
+void *poolAlloc(Pool *pool) {
+    if (pool->freeList != NULL) {
+        void *object = pool->freeList;
+        pool->freeList = *(void **)object;
+        pool->inUse++;
+        return object;
+    }
+    if (pool->bump == NULL || pool->bump + pool->objectSize > pool->bumpEnd) {
+        if (pool->regionCount == pool->regionCapacity) {
+            size_t capacity = pool->regionCapacity ? pool->regionCapacity * 2 : 16;
+            void **regions = (void **)realloc(pool->regions, capacity * sizeof(void *));
+            if (!regions) {
+                perror("Failed to allocate memory for arena regions");
+                return NULL;
             }
-            // "Account does not exist" message is also printed inside deleteAccount
+            pool->regions = regions;
+            pool->regionCapacity = capacity;
         }
-        // Display all accounts command
-        else if (strcmp(commandInput, "DISPLAY") == 0) {
-            accountsHead = sortAccountListByNumber(accountsHead); // Sort accounts before displaying
-            display(accountsHead);
-        }
-        // Display low balance accounts command
-        else if (strcmp(commandInput, "LOWBALANCE") == 0) {
-            accountsHead = sortAccountListByNumber(accountsHead); // Sort accounts before displaying relevant ones
-            lowBalanceAccounts(accountsHead);
+        PageMode backing;
+        char *region = (char *)regionMap(&backing);
+        if (region == NULL) {
+            return NULL;
         }
-        // Transaction command
-        else if (strcmp(commandInput, "TRANSACTION") == 0) {
-            printf("Enter account number for transaction: ");
-            scanf("%d", &targetAccountNumberInput);
-            printf("Enter amount: ");
-            scanf("%f", &amountInput);
-            printf("Enter transaction code (1 for deposit, 0 for withdrawal): ");
-            scanf("%d", &transactionCodeInput);
-            accountsHead = transaction(accountsHead, targetAccountNumberInput, amountInput, transactionCodeInput);
+        pool->regions[pool->regionCount++] = region;
+        pool->hugeRegions += backing == PAGES_EXPLICIT;
+        pool->adviseRegions += backing == PAGES_THP;
+        pool->bump = region;
+        pool->bumpEnd = region + ARENA_REGION_SIZE;
+    }
+    void *object = pool->bump;
+    pool->bump += pool->objectSize;
+    pool->inUse++;
+    return object;
+}
+
+// Returns an object to its pool.
+void poolFree(Pool *pool, void *object) {
+    if (object == NULL) {
+        return;
+    }
+    *(void **)object = pool->freeList;
+    pool->freeList = object;
+    pool->inUse--;
+}
+
+// Unmaps every region of a pool. Every object of the pool becomes invalid.
+void poolRelease(Pool *pool) {
+    for (size_t i = 0; i < pool->regionCount; i++) {
+        munmap(pool->regions[i], ARENA_REGION_SIZE);
+    }
+    free(pool->regions);
+    size_t objectSize = pool->objectSize;
+    memset(pool, 0, sizeof(*pool));
+    pool->objectSize = objectSize;
+}
+
+// Prints how much memory a pool holds and how it is backed.
+void printPool(const char *label, const Pool *pool) {
+    fprintf(bankOut, "%s: %lld object(s) in %zu region(s) of 2 MB (%zu explicit huge, %zu THP-advised)\n",
+            label, pool->inUse, pool->regionCount, pool->hugeRegions, pool->adviseRegions);
+}
+
+// Interned names.
+// A customer may hold one savings and one current account under the same name, so names are
+// interned: every distinct name is stored once, in an entry that counts the accounts using
+// it, and accounts with equal names share the same pointer. Comparing names is then a
+// pointer comparison. Entries that fit a name slot come from namePool, longer ones from the
+// heap. Interned names must not be modified. Use with bankLock held.
+typedef struct InternedName {
+    struct InternedName *next;  // Next entry of the same bucket
+    uint64_t hash;
+    uint32_t refs;              // Accounts using this name
+    int accounts[ACCOUNT_TYPE_COUNT]; // Number of the account of each AccountType with this name, or 0
+    char text[];
+} InternedName;
+
+InternedName **nameTable = NULL;
+size_t nameBuckets = 0;         // Always a power of two
+size_t nameCount = 0;           // Distinct names
+long long nameRefs = 0;         // Names handed out, i.e. accounts
+
+// Returns the hash of a name (FNV-1a).
+uint64_t nameHash(const char *name) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (const char *p = name; *p; p++) {
+        h = (h ^ (unsigned char)*p) * 0x100000001b3ULL;
+    }
+    return mix64(h);
+}
+
+// Returns the entry of an interned name.
+InternedName *nameEntry(const char *name) {
+    return (InternedName *)(name - offsetof(InternedName, text));
+}
+
+// Returns the interned copy of 'name', or NULL if no account uses that name.
+const char *nameLookup(const char *name) {
+    if (nameBuckets == 0) {
+        return NULL;
+    }
+    uint64_t hash = nameHash(name);
+    for (InternedName *e = nameTable[hash & (nameBuckets - 1)]; e != NULL; e = e->next) {
+        if (e->hash == hash && strcmp(e->text, name) == 0) {
+            return e->text;
+        }
+    }
+    return NULL;
+}
+
+// Doubles the bucket array. Returns 0 on success, -1 if memory ran out.
+int nameTableGrow(void) {
+    size_t buckets = nameBuckets ? nameBuckets * 2 : 1024;
+    InternedName **table = (InternedName **)calloc(buckets, sizeof(InternedName *));
+    if (table == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < nameBuckets; i++) {
+        while (nameTable[i] != NULL) {
+            InternedName *e = nameTable[i];
+            nameTable[i] = e->next;
+            e->next = table[e->hash & (buckets - 1)];
+            table[e->hash & (buckets - 1)] = e;
+        }
+    }
+    free(nameTable);
+    nameTable = table;
+    nameBuckets = buckets;
+    return 0;
+}
+
+// Returns the interned copy of 'name', adding it if it is new, and counts one more user.
+// Release it with nameRelease(). Returns NULL if memory ran out.
+char *nameIntern(const char *name) {
+    const char *existing = nameLookup(name);
+    if (existing != NULL) {
+        nameEntry(existing)->refs++;
+        nameRefs++;
+        return (char *)existing;
+    }
+    if (nameCount >= nameBuckets && nameTableGrow() < 0 && nameBuckets == 0) {
+        return NULL; // A full table only gets longer chains, but there must be one
+    }
+    size_t size = offsetof(InternedName, text) + strlen(name) + 1;
+    InternedName *e = (InternedName *)(size <= NAME_SLOT_SIZE ? poolAlloc(&namePool) : malloc(size));
+    if (e == NULL) {
+        return NULL;
+    }
+    e->hash = nameHash(name);
+    e->refs = 1;
+    memset(e->accounts, 0, sizeof(e->accounts));
+    memcpy(e->text, name, size - offsetof(InternedName, text));
+    e->next = nameTable[e->hash & (nameBuckets - 1)];
+    nameTable[e->hash & (nameBuckets - 1)] = e;
+    nameCount++;
+    nameRefs++;
+    return e->text;
+}
+
+// Returns the number of the account with this name and type, or 0 if there is none.
+// Evicted accounts (see the cold tier) count too: the name stays interned for them.
+int nameAccount(const char *name, AccountType accountType) {
+    const char *interned = nameLookup(name);
+    return interned != NULL ? nameEntry(interned)->accounts[accountType] : 0;
+}
+
+// Frees an entry, from the pool or the heap depending on its size.
+void nameEntryFree(InternedName *e) {
+    if (offsetof(InternedName, text) + strlen(e->text) + 1 <= NAME_SLOT_SIZE) {
+        poolFree(&namePool, e);
+    } else {
+        free(e);
+    }
+}
+
+// Gives up one use of an interned name; the last one frees it.
+void nameRelease(char *name) {
+    if (name == NULL) {
+        return;
+    }
+    InternedName *e = nameEntry(name);
+    nameRefs--;
+    if (--e->refs > 0) {
+        return;
+    }
+    InternedName **link = &nameTable[e->hash & (nameBuckets - 1)];
+    while (*link != e) {
+        link = &(*link)->next;
+    }
+    *link = e->next;
+    nameCount--;
+    nameEntryFree(e);
+}
+
+// Frees the bucket array and every name still in it (those of evicted accounts).
+void nameTableFree(void) {
+    for (size_t i = 0; i < nameBuckets; i++) {
+        while (nameTable[i] != NULL) {
+            InternedName *e = nameTable[i];
+            nameTable[i] = e->next;
+            nameEntryFree(e);
+        }
+    }
+    free(nameTable);
+    nameTable = NULL;
+    nameBuckets = nameCount = 0;
+    nameRefs = 0;
+}
+
+// Account number index.
+// Maps an account number to its node in O(1). Account numbers are dense (new ones count
+// up from FIRST_ACCOUNT_NUMBER and deleted ones are recycled), so the index is a two-level
+// table: a fixed directory of chunks, each covering INDEX_CHUNK_SIZE consecutive numbers.
+// Chunks are allocated on first use and never move, so lookups need no lock.
+#define INDEX_CHUNK_BITS 12
+#define INDEX_CHUNK_SIZE (1 << INDEX_CHUNK_BITS)
+#define INDEX_MAX_CHUNKS (1 << 16)
+
+AccountNode **accountIndex[INDEX_MAX_CHUNKS];
+
+// Records 'node' (or NULL) as the account with the given number.
+// Returns 0 on success, -1 if the number is out of range or memory ran out.
+int indexSet(int accountNumber, AccountNode *node) {
+    uint32_t slot = (uint32_t)(accountNumber - FIRST_ACCOUNT_NUMBER);
+    if (accountNumber < FIRST_ACCOUNT_NUMBER || (slot >> INDEX_CHUNK_BITS) >= INDEX_MAX_CHUNKS) {
+        return node == NULL ? 0 : -1;
+    }
+    AccountNode **chunk = accountIndex[slot >> INDEX_CHUNK_BITS];
+    if (chunk == NULL) {
+        if (node == NULL) {
+            return 0;
+        }
+        indexPool.objectSize = INDEX_CHUNK_SIZE * sizeof(AccountNode *);
+        chunk = (AccountNode **)poolAlloc(&indexPool);
+        if (chunk != NULL) {
+            memset(chunk, 0, INDEX_CHUNK_SIZE * sizeof(AccountNode *));
+        } else {
+            perror("Failed to allocate memory for account index");
+            return -1;
+        }
+        __atomic_store_n(&accountIndex[slot >> INDEX_CHUNK_BITS], chunk, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&chunk[slot & (INDEX_CHUNK_SIZE - 1)], node, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// Returns the account with the given number, or NULL if there is none.
+AccountNode *findAccountByNumber(int accountNumber) {
+    uint32_t slot = (uint32_t)(accountNumber - FIRST_ACCOUNT_NUMBER);
+    if (accountNumber < FIRST_ACCOUNT_NUMBER || (slot >> INDEX_CHUNK_BITS) >= INDEX_MAX_CHUNKS) {
+        return NULL;
+    }
+    AccountNode **chunk = __atomic_load_n(&accountIndex[slot >> INDEX_CHUNK_BITS], __ATOMIC_ACQUIRE);
+    if (chunk == NULL) {
+        return NULL;
+    }
+    return __atomic_load_n(&chunk[slot & (INDEX_CHUNK_SIZE - 1)], __ATOMIC_ACQUIRE);
+}
+
+// Releases the index chunks.
+void indexFree(void) {
+    for (int i = 0; i < INDEX_MAX_CHUNKS; i++) {
+        poolFree(&indexPool, accountIndex[i]);
+        accountIndex[i] = NULL;
+    }
+}
+
+// Name dictionary.
+// A sorted set of distinct names, front-coded in blocks of NAME_DICT_BLOCK names: the first
+// name of a block is stored in full, every other one as the length of the prefix it shares
+// with the name before it followed by the rest. Sorted names share long prefixes, so the
+// dictionary is much smaller than the names themselves. A name's ID is its rank. An index
+// of block offsets allows a binary search over the first names of the blocks, after which
+// at most one block is decoded. Lengths are LEB128 varints.
+#define NAME_DICT_BLOCK 16
+#define NAME_DICT_MAX_NAME 256          // Buffer size for a decoded name
+
+typedef struct NameDict {
+    unsigned char *data;        // Front-coded blocks
+    uint32_t size;              // Bytes used in data
+    uint32_t *blockOffsets;     // Offset of each block in data
+    uint32_t blockCount;
+    uint32_t count;             // Names
+} NameDict;
+
+// Decodes names of a dictionary one after another.
+typedef struct NameDictCursor {
+    const NameDict *dict;
+    uint32_t id;                // ID of the name the next call returns
+    const unsigned char *p;     // Its encoding
+    char name[NAME_DICT_MAX_NAME]; // The name last returned
+} NameDictCursor;
+
+// Writes 'value' as a varint at 'p'. Returns the number of bytes written (at most 5).
+size_t varintPut(unsigned char *p, uint32_t value) {
+    size_t n = 0;
+    while (value >= 0x80) {
+        p[n++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    p[n++] = (unsigned char)value;
+    return n;
+}
+
+// Reads a varint at *p and advances *p past it.
+uint32_t varintGet(const unsigned char **p) {
+    uint32_t value = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        unsigned char byte = *(*p)++;
+        value |= (uint32_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            break;
+        }
+    }
+    return value;
+}
+
+// Reads a varint at *p that must end before 'end' and advances *p past it.
+// Returns 1 on success, 0 if the varint runs past 'end' or does not fit in 32 bits.
+int varintGetBounded(const unsigned char **p, const unsigned char *end, uint32_t *value) {
+    *value = 0;
+    for (int shift = 0; shift < 35 && *p < end; shift += 7) {
+        unsigned char byte = *(*p)++;
+        if (shift == 28 && byte > 0x0f) {
+            return 0;
+        }
+        *value |= (uint32_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Builds a dictionary of 'count' names, which must be sorted (by strcmp()) and distinct.
+// Returns 0 on success, -1 if memory ran out.
+int nameDictBuild(NameDict *dict, const char *const *names, uint32_t count) {
+    memset(dict, 0, sizeof(*dict));
+    size_t capacity = 1;
+    for (uint32_t i = 0; i < count; i++) {
+        capacity += strlen(names[i]) + 10; // Two varints at most
+    }
+    uint32_t blocks = (count + NAME_DICT_BLOCK - 1) / NAME_DICT_BLOCK;
+    if (capacity > UINT32_MAX) {
+        return -1;
+    }
+    dict->data = (unsigned char *)malloc(capacity);
+    dict->blockOffsets = (uint32_t *)malloc((blocks ? blocks : 1) * sizeof(uint32_t));
+    if (dict->data == NULL || dict->blockOffsets == NULL) {
+        free(dict->data);
+        free(dict->blockOffsets);
+        memset(dict, 0, sizeof(*dict));
+        return -1;
+    }
+    size_t used = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        size_t length = strlen(names[i]);
+        size_t shared = 0;
+        if (i % NAME_DICT_BLOCK == 0) {
+            dict->blockOffsets[i / NAME_DICT_BLOCK] = (uint32_t)used;
+        } else {
+            while (names[i][shared] != '\0' && names[i][shared] == names[i - 1][shared]) {
+                shared++;
+            }
+            used += varintPut(dict->data + used, (uint32_t)shared);
+        }
+        used += varintPut(dict->data + used, (uint32_t)(length - shared));
+        memcpy(dict->data + used, names[i] + shared, length - shared);
+        used += length - shared;
+    }
+    dict->size = (uint32_t)used;
+    dict->blockCount = blocks;
+    dict->count = count;
+    return 0;
+}
+
+// Releases a dictionary.
+void nameDictFree(NameDict *dict) {
+    free(dict->data);
+    free(dict->blockOffsets);
+    memset(dict, 0, sizeof(*dict));
+}
+
+// Returns the next name of a cursor and advances it, or NULL after the last name.
+// The name stays valid until the cursor moves again.
+const char *nameDictNext(NameDictCursor *cursor) {
+    if (cursor->id >= cursor->dict->count) {
+        return NULL;
+    }
+    size_t shared = cursor->id % NAME_DICT_BLOCK == 0 ? 0 : varintGet(&cursor->p);
+    size_t rest = varintGet(&cursor->p);
+    size_t keep = rest;
+    if (shared > NAME_DICT_MAX_NAME - 1) {
+        shared = NAME_DICT_MAX_NAME - 1;
+    }
+    if (shared + keep > NAME_DICT_MAX_NAME - 1) {
+        keep = NAME_DICT_MAX_NAME - 1 - shared; // Too long for the buffer: truncate
+    }
+    memcpy(cursor->name + shared, cursor->p, keep);
+    cursor->name[shared + keep] = '\0';
+    cursor->p += rest;
+    cursor->id++;
+    return cursor->name;
+}
+
+// Positions a cursor so that the next nameDictNext() returns the name with ID 'id'.
+void nameDictSeek(NameDictCursor *cursor, const NameDict *dict, uint32_t id) {
+    cursor->dict = dict;
+    cursor->name[0] = '\0';
+    if (id >= dict->count) {
+        cursor->id = dict->count;
+        return;
+    }
+    cursor->id = id - id % NAME_DICT_BLOCK;
+    cursor->p = dict->data + dict->blockOffsets[id / NAME_DICT_BLOCK];
+    while (cursor->id < id) {
+        nameDictNext(cursor); // Later names are coded against this one
+    }
+}
+
+// Copies the name with ID 'id' into 'buffer' of 'size' bytes. Returns 'buffer'.
+char *nameDictGet(const NameDict *dict, uint32_t id, char *buffer, size_t size) {
+    NameDictCursor cursor;
+    nameDictSeek(&cursor, dict, id);
+    const char *name = nameDictNext(&cursor);
+    snprintf(buffer, size, "%s", name != NULL ? name : "");
+    return buffer;
+}
+
+// Checks that every name of a dictionary read from a file decodes inside its block and fits
+// NAME_DICT_MAX_NAME, and that no name shares more than the length of the name before it.
+// The other functions trust the dictionary; a built one always passes.
+// Returns 1 if the dictionary is well formed, 0 if not.
+int nameDictCheck(const NameDict *dict) {
+    for (uint32_t block = 0; block < dict->blockCount; block++) {
+        uint32_t start = dict->blockOffsets[block];
+        uint32_t stop = block + 1 < dict->blockCount ? dict->blockOffsets[block + 1] : dict->size;
+        if (start > stop || stop > dict->size) {
+            return 0;
+        }
+        const unsigned char *p = dict->data + start;
+        const unsigned char *end = dict->data + stop;
+        uint32_t previous = 0; // Length of the name before
+        uint32_t first = block * NAME_DICT_BLOCK;
+        for (uint32_t id = first; id < dict->count && id < first + NAME_DICT_BLOCK; id++) {
+            uint32_t shared = 0;
+            uint32_t rest;
+            if ((id != first && !varintGetBounded(&p, end, &shared)) || shared > previous ||
+                !varintGetBounded(&p, end, &rest) || rest > (uint32_t)(end - p) ||
+                shared + rest > NAME_DICT_MAX_NAME - 1) {
+                return 0;
+            }
+            p += rest;
+            previous = shared + rest;
+        }
+    }
+    return 1;
+}
+
+// Returns the ID of 'name', or -1 if the dictionary does not hold it.
+long long nameDictFind(const NameDict *dict, const char *name) {
+    // Find the last block whose first name is not greater than 'name'
+    uint32_t lo = 0, hi = dict->blockCount;
+    size_t length = strlen(name);
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        const unsigned char *p = dict->data + dict->blockOffsets[mid];
+        size_t firstLength = varintGet(&p);
+        int cmp = memcmp(name, p, length < firstLength ? length : firstLength);
+        if (cmp > 0 || (cmp == 0 && length >= firstLength)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == 0) {
+        return -1; // Sorts before every name
+    }
+    NameDictCursor cursor;
+    nameDictSeek(&cursor, dict, (lo - 1) * NAME_DICT_BLOCK);
+    for (int i = 0; i < NAME_DICT_BLOCK; i++) {
+        const char *candidate = nameDictNext(&cursor);
+        if (candidate == NULL) {
+            break;
+        }
+        int cmp = strcmp(candidate, name);
+        if (cmp == 0) {
+            return cursor.id - 1;
+        }
+        if (cmp > 0) {
+            break;
+        }
+    }
+    return -1;
+}
+
+// Orders two strings for qsort().
+int compareNames(const void *a, const void *b) {
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+// Packed account records.
+// Besides its node, every account has a 16-byte record in a dense table indexed by account
+// number, holding just what scans need: the balance in paise, the type, a few flags and where
+// its name is kept. Four records share a cache line, so LOWBALANCE and RECONCILE walk the
+// book in number order by streaming through this table instead of chasing account nodes.
+// The table grows under bankLock; a slot that never held an account is all zero.
+// Names are kept in a name dictionary that is rebuilt now and then, and the names added
+// since the last rebuild in an append-only arena.
+#define PACKED_NUMBER_MASK 0x07ffffffu  // Account number: the low 27 bits
+#define PACKED_TYPE_SHIFT  27           // AccountType: the next 2 bits
+#define PACKED_TYPE_MASK   0x18000000u
+#define MAX_ACCOUNT_NUMBER ((int)PACKED_NUMBER_MASK) // No account can be recorded above this
+#define PACKED_TOMBSTONE   0x20000000u  // Account was deleted
+#define PACKED_LOW_BALANCE 0x40000000u  // Balance below the low-balance limit of its type
+#define PACKED_DORMANT     0x80000000u  // No activity for a long time
+#define PACKED_NAME_IN_DICT 0x80000000u // In nameOffset: the rest is an ID in packedDict
+#define PACKED_ARENA_MIN (64 << 10)     // Arena size below which it is never folded in
+
+_Static_assert(ACCOUNT_TYPE_COUNT <= (PACKED_TYPE_MASK >> PACKED_TYPE_SHIFT) + 1, "packed records have room for 4 account types");
+_Static_assert((uint64_t)MAX_ACCOUNT_NUMBER < (1ULL << ACCOUNT_KEY_TYPE_SHIFT), "account key hashes keep the type clear of the number");
+
+typedef struct PackedAccount {
+    int64_t balance;            // Balance in paise
+    uint32_t numberFlags;       // Account number and PACKED_* flags
+    uint32_t nameOffset;        // Offset of the name in packedNames, or its ID in packedDict
+} PackedAccount;
+
+_Static_assert(sizeof(PackedAccount) == 16, "PackedAccount must stay 16 bytes");
+
+PackedAccount *packedTable = NULL;
+uint32_t packedCapacity = 0;    // Slots allocated in packedTable
+uint32_t packedHighWater = 0;   // Slots at or above this have never been used
+
+// Names of the packed records added since the dictionary was last rebuilt, one after
+// another. Deleting an account leaves its name behind as garbage until the next rebuild.
+typedef struct NameArena {
+    char *data;
+    uint32_t used;
+    uint32_t capacity;
+    uint32_t garbage;           // Bytes belonging to deleted accounts, here or in packedDict
+} NameArena;
+
+NameArena packedNames;
+NameDict packedDict;
+
+// Converts a balance to paise, rounding to the nearest paisa.
+long long toPaise(double amount) {
+    return (long long)(amount * 100.0 + (amount < 0 ? -0.5 : 0.5));
+}
+
+// Returns the flags that depend on the balance of an account of the given type.
+uint32_t packedBalanceFlags(AccountType type, float amount) {
+    return amount < accountPolicies[type].lowBalance ? PACKED_LOW_BALANCE : 0; // The same test as the LOWBALANCE report
+}
+
+// Returns the record of a live account, or NULL if there is none.
+PackedAccount *packedRecord(int accountNumber) {
+    uint32_t slot = (uint32_t)(accountNumber - FIRST_ACCOUNT_NUMBER);
+    if (accountNumber < FIRST_ACCOUNT_NUMBER || slot >= packedHighWater) {
+        return NULL;
+    }
+    PackedAccount *record = &packedTable[slot];
+    if (record->numberFlags == 0 || (record->numberFlags & PACKED_TOMBSTONE)) {
+        return NULL;
+    }
+    return record;
+}
+
+// Returns 1 if a table slot holds a live account.
+int packedLive(const PackedAccount *record) {
+    return record->numberFlags != 0 && !(record->numberFlags & PACKED_TOMBSTONE);
+}
+
+// Returns the account type of a record.
+AccountType packedType(const PackedAccount *record) {
+    return (AccountType)((record->numberFlags & PACKED_TYPE_MASK) >> PACKED_TYPE_SHIFT);
+}
+
+// Copies the name of a packed record into 'buffer' of 'size' bytes. Returns 'buffer'.
+char *packedNameCopy(const PackedAccount *record, char *buffer, size_t size) {
+    if (record->nameOffset & PACKED_NAME_IN_DICT) {
+        return nameDictGet(&packedDict, record->nameOffset & ~PACKED_NAME_IN_DICT, buffer, size);
+    }
+    snprintf(buffer, size, "%s", packedNames.data + record->nameOffset);
+    return buffer;
+}
+
+// Counts the name of a record that is going away as garbage.
+void packedNameDropped(const PackedAccount *record) {
+    char name[NAME_DICT_MAX_NAME];
+    packedNames.garbage += (uint32_t)strlen(packedNameCopy(record, name, sizeof(name))) + 1;
+}
+
+// Rebuilds the dictionary from the names of the live records, leaving the arena empty:
+// names of deleted accounts are dropped and recent names join the dictionary.
+// Returns 0 on success, -1 if memory could not be allocated.
+int packedNamesCompact(void) {
+    uint32_t live = 0;
+    size_t textSize = 0;
+    char name[NAME_DICT_MAX_NAME];
+    for (uint32_t slot = 0; slot < packedHighWater; slot++) {
+        if (packedLive(&packedTable[slot])) {
+            live++;
+            textSize += strlen(packedNameCopy(&packedTable[slot], name, sizeof(name))) + 1;
+        }
+    }
+    // Decode every live name once, then sort and deduplicate them
+    char *text = (char *)malloc(textSize ? textSize : 1);
+    const char **names = (const char **)malloc((live ? live : 1) * sizeof(char *));
+    if (text == NULL || names == NULL) {
+        free(text);
+        free(names);
+        return -1;
+    }
+    size_t used = 0;
+    uint32_t count = 0;
+    for (uint32_t slot = 0; slot < packedHighWater; slot++) {
+        if (packedLive(&packedTable[slot])) {
+            names[count++] = packedNameCopy(&packedTable[slot], text + used, textSize - used);
+            used += strlen(text + used) + 1;
+        }
+    }
+    qsort(names, count, sizeof(char *), compareNames);
+    uint32_t distinct = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (distinct == 0 || strcmp(names[distinct - 1], names[i]) != 0) {
+            names[distinct++] = names[i];
+        }
+    }
+    NameDict dict;
+    int status = nameDictBuild(&dict, names, distinct);
+    if (status == 0) {
+        for (uint32_t slot = 0; slot < packedHighWater; slot++) {
+            PackedAccount *record = &packedTable[slot];
+            if (packedLive(record)) {
+                record->nameOffset = (uint32_t)nameDictFind(&dict, packedNameCopy(record, name, sizeof(name))) | PACKED_NAME_IN_DICT;
+            }
+        }
+        nameDictFree(&packedDict);
+        packedDict = dict;
+        packedNames.used = 0;
+        packedNames.garbage = 0;
+    }
+    free(names);
+    free(text);
+    return status;
+}
+
+// Appends a name to the arena. Returns its offset, or UINT32_MAX if memory ran out.
+uint32_t packedNameAdd(const char *name) {
+    size_t length = strlen(name) + 1;
+    // Fold the arena into the dictionary when it is mostly deleted names or has grown large
+    // next to the dictionary; the dictionary grows geometrically, so rebuilds stay rare.
+    if (packedNames.garbage > (packedNames.used + packedDict.size) / 2 ||
+        (packedNames.used >= PACKED_ARENA_MIN && packedNames.used > packedDict.size / 2)) {
+        packedNamesCompact();
+    }
+    if ((size_t)packedNames.used + length > packedNames.capacity) {
+        size_t capacity = packedNames.capacity ? packedNames.capacity : 4096;
+        while (capacity < (size_t)packedNames.used + length) {
+            capacity *= 2;
+        }
+        if (capacity > PACKED_NAME_IN_DICT) {
+            return UINT32_MAX;
+        }
+        char *data = (char *)realloc(packedNames.data, capacity);
+        if (data == NULL) {
+            return UINT32_MAX;
+        }
+        packedNames.data = data;
+        packedNames.capacity = (uint32_t)capacity;
+    }
+    uint32_t offset = packedNames.used;
+    memcpy(packedNames.data + offset, name, length);
+    packedNames.used += (uint32_t)length;
+    return offset;
+}
+
+// Records a new account. Returns 0 on success, -1 if memory could not be allocated.
+int packedAdd(int accountNumber, const char *name, AccountType type, float amount) {
+    uint32_t slot = (uint32_t)(accountNumber - FIRST_ACCOUNT_NUMBER);
+    if (accountNumber < FIRST_ACCOUNT_NUMBER || (uint32_t)accountNumber > PACKED_NUMBER_MASK) {
+        return -1;
+    }
+    if (slot >= packedCapacity) {
+        uint32_t capacity = packedCapacity ? packedCapacity : 1024;
+        while (capacity <= slot) {
+            capacity *= 2;
+        }
+        PackedAccount *table = (PackedAccount *)realloc(packedTable, capacity * sizeof(PackedAccount));
+        if (table == NULL) {
+            perror("Failed to allocate memory for packed accounts");
+            return -1;
+        }
+        memset(table + packedCapacity, 0, (capacity - packedCapacity) * sizeof(PackedAccount));
+        packedTable = table;
+        packedCapacity = capacity;
+    }
+    PackedAccount *record = &packedTable[slot];
+    if (packedLive(record)) {
+        packedNameDropped(record); // Replaced without a delete
+    }
+    record->numberFlags = 0; // Not live while the name is added
+    uint32_t nameOffset = packedNameAdd(name);
+    if (nameOffset == UINT32_MAX) {
+        perror("Failed to allocate memory for packed account names");
+        return -1;
+    }
+    record->balance = toPaise(amount);
+    record->numberFlags = (uint32_t)accountNumber | ((uint32_t)type << PACKED_TYPE_SHIFT) | packedBalanceFlags(type, amount);
+    record->nameOffset = nameOffset;
+    if (slot >= packedHighWater) {
+        packedHighWater = slot + 1;
+    }
+    return 0;
+}
+
+// Records a new balance.
+void packedSetBalance(int accountNumber, float amount) {
+    PackedAccount *record = packedRecord(accountNumber);
+    if (record != NULL) {
+        record->balance = toPaise(amount);
+        record->numberFlags = (record->numberFlags & ~PACKED_LOW_BALANCE) | packedBalanceFlags(packedType(record), amount);
+    }
+}
+
+// Marks an account as deleted; its slot is reused if the number is.
+void packedRemove(int accountNumber) {
+    PackedAccount *record = packedRecord(accountNumber);
+    if (record != NULL) {
+        packedNameDropped(record);
+        record->numberFlags |= PACKED_TOMBSTONE;
+    }
+}
+
+// Releases the packed records and their names.
+void packedFree(void) {
+    free(packedTable);
+    free(packedNames.data);
+    packedTable = NULL;
+    packedCapacity = packedHighWater = 0;
+    memset(&packedNames, 0, sizeof(packedNames));
+    nameDictFree(&packedDict);
+}
+
+// Account activity.
+// The time of the last change to each account (its creation or a balance change), in seconds
+// since the epoch, in a table indexed by account number like the packed records. The cold
+// tier uses it to find the accounts that have been idle long enough to move to disk.
+// Every account is also on the list of the day of its last change: one doubly linked list
+// per day, threaded through the table, so the accounts idle since a given day are found by
+// walking the lists of the days before it instead of the whole book (see DORMANT).
+#define SECONDS_PER_DAY 86400
+
+typedef struct ActivityEntry {
+    uint32_t time;              // Last change, or 0 if the slot holds no account
+    uint32_t prev;              // Previous slot + 1 on the same day list, or 0
+    uint32_t next;              // Next slot + 1 on the same day list, or 0
+} ActivityEntry;
+
+ActivityEntry *activityTable = NULL;
+uint32_t activityCapacity = 0;  // Slots allocated in activityTable
+uint32_t *dayHeads = NULL;      // Per day since firstDay: first slot + 1 of its list, or 0
+uint32_t dayCount = 0;          // Days allocated in dayHeads
+uint32_t firstDay = 0;          // Day (since the epoch) of dayHeads[0]
+
+// Returns the list head of a day; earlier days share the first list.
+uint32_t *dayHead(uint32_t day) {
+    return &dayHeads[day > firstDay ? day - firstDay : 0];
+}
+
+// Takes a slot off its day list.
+void activityUnlink(uint32_t slot) {
+    ActivityEntry *e = &activityTable[slot];
+    if (e->time == 0) {
+        return;
+    }
+    if (e->prev != 0) {
+        activityTable[e->prev - 1].next = e->next;
+    } else {
+        *dayHead(e->time / SECONDS_PER_DAY) = e->next;
+    }
+    if (e->next != 0) {
+        activityTable[e->next - 1].prev = e->prev;
+    }
+    e->time = e->prev = e->next = 0;
+}
+
+// Records activity on an account at changeTime(). Returns 0 on success, -1 if memory ran out.
+int activityTouch(int accountNumber) {
+    uint32_t slot = (uint32_t)(accountNumber - FIRST_ACCOUNT_NUMBER);
+    uint32_t now = changeTime();
+    uint32_t day = now / SECONDS_PER_DAY;
+    if (accountNumber < FIRST_ACCOUNT_NUMBER) {
+        return -1;
+    }
+    if (slot >= activityCapacity) {
+        uint32_t capacity = activityCapacity ? activityCapacity : 1024;
+        while (capacity <= slot) {
+            capacity *= 2;
+        }
+        ActivityEntry *table = (ActivityEntry *)realloc(activityTable, capacity * sizeof(ActivityEntry));
+        if (table == NULL) {
+            perror("Failed to allocate memory for account activity");
+            return -1;
+        }
+        memset(table + activityCapacity, 0, (capacity - activityCapacity) * sizeof(ActivityEntry));
+        activityTable = table;
+        activityCapacity = capacity;
+    }
+    if (dayHeads == NULL) {
+        firstDay = day;
+    }
+    if (day >= firstDay + dayCount) {
+        uint32_t count = dayCount ? dayCount : 64;
+        while (day >= firstDay + count) {
+            count *= 2;
+        }
+        uint32_t *heads = (uint32_t *)realloc(dayHeads, count * sizeof(uint32_t));
+        if (heads == NULL) {
+            perror("Failed to allocate memory for account activity");
+            return -1;
+        }
+        memset(heads + dayCount, 0, (count - dayCount) * sizeof(uint32_t));
+        dayHeads = heads;
+        dayCount = count;
+    }
+    activityUnlink(slot);
+    ActivityEntry *e = &activityTable[slot];
+    uint32_t *head = dayHead(day);
+    e->time = now;
+    e->next = *head;
+    if (*head != 0) {
+        activityTable[*head - 1].prev = slot + 1;
+    }
+    *head = slot + 1;
+    PackedAccount *record = packedRecord(accountNumber);
+    if (record != NULL) {
+        record->numberFlags &= ~PACKED_DORMANT; // Active again
+    }
+    return 0;
+}
+
+// Forgets the activity of an account that is being deleted.
+void activityForget(int accountNumber) {
+    uint32_t slot = (uint32_t)(accountNumber - FIRST_ACCOUNT_NUMBER);
+    if (accountNumber >= FIRST_ACCOUNT_NUMBER && slot < activityCapacity) {
+        activityUnlink(slot);
+    }
+}
+
+// Returns when an account last changed, or 0 if that is not known.
+uint32_t activityOf(int accountNumber) {
+    uint32_t slot = (uint32_t)(accountNumber - FIRST_ACCOUNT_NUMBER);
+    return accountNumber >= FIRST_ACCOUNT_NUMBER && slot < activityCapacity ? activityTable[slot].time : 0;
+}
+
+// Releases the activity table and the day lists.
+void activityFree(void) {
+    free(activityTable);
+    free(dayHeads);
+    activityTable = NULL;
+    dayHeads = NULL;
+    activityCapacity = dayCount = firstDay = 0;
+}
+
+// Average daily balance.
+// Savings interest is paid on the average balance over the accrual period. Rather than keep
+// the history of every account, each one carries the integral of its balance over time since
+// the period began: a balance change adds the old balance times the seconds it was held, in
+// O(1). The average is the integral, topped up to now, over the length of the period, so an
+// accrual run needs two numbers per account and no history (see accrueInterest()).
+#define SECONDS_PER_YEAR (365 * SECONDS_PER_DAY)
+
+typedef struct BalanceIntegral {
+    double paiseSeconds;        // Balance in paise times the seconds it was held, since periodStart
+    long long paise;            // Balance since 'since'
+    uint32_t since;             // Time of the last balance change
+    uint32_t periodStart;       // Start of the accrual period, or 0 if the slot holds no account
+} BalanceIntegral;
+
+BalanceIntegral *balanceIntegrals = NULL;
+uint32_t balanceIntegralCapacity = 0; // Slots allocated in balanceIntegrals
+
+// Returns the integral of an account, growing the table as needed, or NULL.
+BalanceIntegral *balanceIntegralOf(int accountNumber) {
+    uint32_t slot = (uint32_t)(accountNumber - FIRST_ACCOUNT_NUMBER);
+    if (accountNumber < FIRST_ACCOUNT_NUMBER) {
+        return NULL;
+    }
+    if (slot >= balanceIntegralCapacity) {
+        uint32_t capacity = balanceIntegralCapacity ? balanceIntegralCapacity : 1024;
+        while (capacity <= slot) {
+            capacity *= 2;
+        }
+        BalanceIntegral *table = (BalanceIntegral *)realloc(balanceIntegrals, capacity * sizeof(BalanceIntegral));
+        if (table == NULL) {
+            perror("Failed to allocate memory for average balances");
+            return NULL;
+        }
+        memset(table + balanceIntegralCapacity, 0, (capacity - balanceIntegralCapacity) * sizeof(BalanceIntegral));
+        balanceIntegrals = table;
+        balanceIntegralCapacity = capacity;
+    }
+    return &balanceIntegrals[slot];
+}
+
+// Records that an account's balance is now 'amount', starting its period if it is new.
+void balanceIntegralUpdate(int accountNumber, float amount) {
+    BalanceIntegral *integral = balanceIntegralOf(accountNumber);
+    uint32_t now = changeTime();
+    if (integral == NULL) {
+        return;
+    }
+    if (integral->periodStart == 0) {
+        integral->paiseSeconds = 0;
+        integral->periodStart = now;
+    } else if (now > integral->since) {
+        integral->paiseSeconds += (double)integral->paise * (now - integral->since);
+    }
+    integral->since = now;
+    integral->paise = toPaise(amount);
+}
+
+// Forgets the integral of an account that is being deleted.
+void balanceIntegralForget(int accountNumber) {
+    uint32_t slot = (uint32_t)(accountNumber - FIRST_ACCOUNT_NUMBER);
+    if (accountNumber >= FIRST_ACCOUNT_NUMBER && slot < balanceIntegralCapacity) {
+        memset(&balanceIntegrals[slot], 0, sizeof(BalanceIntegral));
+    }
+}
+
+// Returns the average balance in paise of an account over its period up to 'now'.
+double averageBalance(const BalanceIntegral *integral, uint32_t now) {
+    if (now <= integral->periodStart) {
+        return (double)integral->paise;
+    }
+    double paiseSeconds = integral->paiseSeconds;
+    if (now > integral->since) {
+        paiseSeconds += (double)integral->paise * (now - integral->since);
+    }
+    return paiseSeconds / (now - integral->periodStart);
+}
+
+// Returns the integral of the account in 'slot' if its type earns interest, or NULL.
+BalanceIntegral *interestBearing(uint32_t slot) {
+    if (slot >= balanceIntegralCapacity || slot >= packedHighWater) {
+        return NULL;
+    }
+    BalanceIntegral *integral = &balanceIntegrals[slot];
+    PackedAccount *record = &packedTable[slot];
+    if (integral->periodStart == 0 || !packedLive(record) || accountPolicies[packedType(record)].annualInterest <= 0) {
+        return NULL;
+    }
+    return integral;
+}
+
+// Starts a new accrual period at 'now' for every account that earns interest: what an
+// accrual run does once it has worked the interest out, and what replaying its record does.
+void restartAccrualPeriods(uint32_t now) {
+    for (uint32_t slot = 0; slot < balanceIntegralCapacity && slot < packedHighWater; slot++) {
+        BalanceIntegral *integral = interestBearing(slot);
+        if (integral != NULL) {
+            integral->paiseSeconds = 0;
+            integral->periodStart = integral->since = now;
+        }
+    }
+}
+
+// Releases the table of integrals.
+void balanceIntegralsFree(void) {
+    free(balanceIntegrals);
+    balanceIntegrals = NULL;
+    balanceIntegralCapacity = 0;
+}
+
+// Loans.
+// Loans are linked to current accounts and repaid by equal monthly installments (EMIs)
+// debited from them. The loan book is kept as columns, one array per field, so the month-end
+// run works out the installment of every loan in one pass of fixed-point SSE2 code, two loans
+// per step: amounts are in paise and monthly rates in units of 2^-24. The debits are then
+// posted through applyTransactionBatch() (see postInstallments()).
+#define LOAN_RATE_BITS 24
+#define LOAN_MAX_PRINCIPAL 1000000000.0 // Rs; keeps principal * rate within 64 bits
+#define LOAN_MAX_MONTHS 600
+
+typedef struct LoanBook {
+    int32_t *account;           // Current account the installments are debited from, 0 once settled
+    int64_t *principal;         // Outstanding principal in paise
+    int64_t *monthlyRate;       // Monthly interest rate in units of 2^-LOAN_RATE_BITS
+    int64_t *emi;               // Monthly installment in paise
+    int64_t *due;               // This month's installment, filled in by loanScheduleMonth()
+    int64_t *interest;          // Interest part of 'due'
+    size_t count;               // Loans in the book
+    size_t capacity;            // Loans the columns have room for (always even)
+} LoanBook;
+
+LoanBook loanBook;
+
+// Adds a loan to the book. Returns its index, or -1 if memory ran out.
+long long loanAdd(int accountNumber, int64_t principal, int64_t monthlyRate, int64_t emi) {
+    LoanBook *book = &loanBook;
+    if (book->count == book->capacity) {
+        size_t capacity = book->capacity ? book->capacity * 2 : 64;
+        void **columns[] = {(void **)&book->principal, (void **)&book->monthlyRate, (void **)&book->emi,
+                            (void **)&book->due, (void **)&book->interest};
+        int32_t *account = (int32_t *)realloc(book->account, capacity * sizeof(int32_t));
+        if (account == NULL) {
+            perror("Failed to allocate memory for loans");
+            return -1;
+        }
+        book->account = account;
+        for (size_t c = 0; c < sizeof(columns) / sizeof(columns[0]); c++) {
+            int64_t *column = (int64_t *)realloc(*columns[c], capacity * sizeof(int64_t));
+            if (column == NULL) {
+                perror("Failed to allocate memory for loans");
+                return -1;
+            }
+            // Unused lanes stay zero: no principal, so nothing falls due
+            memset(column + book->capacity, 0, (capacity - book->capacity) * sizeof(int64_t));
+            *columns[c] = column;
+        }
+        memset(book->account + book->capacity, 0, (capacity - book->capacity) * sizeof(int32_t));
+        book->capacity = capacity;
+    }
+    size_t i = book->count++;
+    book->account[i] = accountNumber;
+    book->principal[i] = principal;
+    book->monthlyRate[i] = monthlyRate;
+    book->emi[i] = emi;
+    return (long long)i;
+}
+
+// Works out this month's installment of every loan: the interest on the outstanding principal,
+// rounded to the nearest paisa, and the EMI, or just what is owed if that is less.
+void loanScheduleMonth(LoanBook *book) {
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i half = _mm_set1_epi64x(1 << (LOAN_RATE_BITS - 1));
+    for (; i + 2 <= book->count; i += 2) {
+        __m128i principal = _mm_loadu_si128((const __m128i *)(book->principal + i));
+        __m128i rate = _mm_loadu_si128((const __m128i *)(book->monthlyRate + i));
+        // principal * rate from two 32x32-bit products, then scaled down by 2^LOAN_RATE_BITS
+        __m128i low = _mm_mul_epu32(principal, rate);
+        __m128i high = _mm_mul_epu32(_mm_srli_epi64(principal, 32), rate);
+        __m128i interest = _mm_add_epi64(_mm_slli_epi64(high, 32 - LOAN_RATE_BITS),
+                                         _mm_srli_epi64(_mm_add_epi64(low, half), LOAN_RATE_BITS));
+        __m128i emi = _mm_loadu_si128((const __m128i *)(book->emi + i));
+        __m128i excess = _mm_sub_epi64(emi, _mm_add_epi64(principal, interest));
+        // All ones where the EMI does not cover what is owed (SSE2 has no 64-bit compare)
+        __m128i shortfall = _mm_shuffle_epi32(_mm_srai_epi32(excess, 31), _MM_SHUFFLE(3, 3, 1, 1));
+        __m128i due = _mm_sub_epi64(emi, _mm_andnot_si128(shortfall, excess));
+        _mm_storeu_si128((__m128i *)(book->interest + i), interest);
+        _mm_storeu_si128((__m128i *)(book->due + i), due);
+    }
+#endif
+    for (; i < book->count; i++) {
+        int64_t interest = (book->principal[i] * book->monthlyRate[i] + (1 << (LOAN_RATE_BITS - 1))) >> LOAN_RATE_BITS;
+        int64_t owed = book->principal[i] + interest;
+        book->interest[i] = interest;
+        book->due[i] = book->emi[i] < owed ? book->emi[i] : owed;
+    }
+}
+
+// Writes off the loans of an account that is being deleted, so that its number can be reused.
+void loanAccountDeleted(int accountNumber) {
+    for (size_t i = 0; i < loanBook.count; i++) {
+        if (loanBook.account[i] == accountNumber) {
+            loanBook.account[i] = 0;
+            loanBook.principal[i] = 0;
+        }
+    }
+}
+
+// Returns the number of loans with principal outstanding and stores their total in *paise.
+size_t loansOutstanding(int64_t *paise) {
+    size_t open = 0;
+    *paise = 0;
+    for (size_t i = 0; i < loanBook.count; i++) {
+        open += loanBook.principal[i] > 0;
+        *paise += loanBook.principal[i];
+    }
+    return open;
+}
+
+// Releases the loan book.
+void loanBookFree(void) {
+    free(loanBook.account);
+    free(loanBook.principal);
+    free(loanBook.monthlyRate);
+    free(loanBook.emi);
+    free(loanBook.due);
+    free(loanBook.interest);
+    memset(&loanBook, 0, sizeof(loanBook));
+}
+
+// Cold tier.
+// With --cold-store, accounts idle for longer than --cold-after seconds are evicted: the node
+// leaves the store, the list and the index, and its contents go to a 64-byte record in a file
+// of 4 KB pages. The packed record stays in memory as the account's stub and coldSlots says
+// which record holds the rest, so scans of the packed records do not notice. The first
+// transaction on an evicted account faults it back in; reports read evicted accounts from
+// the file without bringing them back. The file is scratch space, recreated at start-up:
+// durability still comes from the WAL and snapshots.
+#define COLD_PAGE_SIZE 4096
+#define DEFAULT_COLD_AFTER (90 * 24 * 60 * 60) // 90 days
+#define COLD_SWEEP_INTERVAL 60                 // Seconds between automatic sweeps
+
+typedef struct ColdRecord {
+    int32_t accountNumber;
+    int32_t accountType;
+    float amount;
+    char name[52];              // Accounts with longer names are never evicted
+} ColdRecord;
+
+_Static_assert(sizeof(ColdRecord) == 64, "ColdRecord must stay 64 bytes");
+
+#define COLD_RECORDS_PER_PAGE (COLD_PAGE_SIZE / sizeof(ColdRecord))
+
+int coldFd = -1;                // Cold store file, or -1 without a cold tier
+uint32_t coldAfter = DEFAULT_COLD_AFTER; // Idle seconds before an account is evicted
+uint32_t *coldSlots = NULL;     // Per account slot: its record number + 1, or 0 if resident
+uint32_t coldSlotCapacity = 0;
+uint32_t coldRecordCount = 0;   // Records in the file, free ones included
+uint32_t *coldFreeRecords = NULL; // Records that can be reused
+uint32_t coldFreeCount = 0;
+uint32_t coldFreeCapacity = 0;
+time_t coldLastSweep = 0;
+_Thread_local AccountNode coldScratch; // An evicted account read back for a report
+pthread_key_t coldScratchKey;           // Frees the scratch report row when its thread exits
+pthread_once_t coldScratchKeyOnce = PTHREAD_ONCE_INIT;
+
+// Frees the report row cached in the scratch copy of an exiting thread.
+void coldScratchRelease(void *scratch) {
+    free(((AccountNode *)scratch)->displayRow);
+}
+
+void coldScratchKeyCreate(void) {
+    pthread_key_create(&coldScratchKey, coldScratchRelease);
+}
+
+// Returns the record number + 1 of an evicted account, or 0 if it is not evicted.
+uint32_t coldRecordOf(int accountNumber) {
+    uint32_t slot = (uint32_t)(accountNumber - FIRST_ACCOUNT_NUMBER);
+    return accountNumber >= FIRST_ACCOUNT_NUMBER && slot < coldSlotCapacity ? coldSlots[slot] : 0;
+}
+
+// Reads an evicted account into 'node' without bringing it back: the copy is not linked
+// anywhere and its name is the interned one the cold record holds on to.
+// Returns 1 on success, 0 if the account is not evicted or cannot be read.
+int coldPeek(int accountNumber, AccountNode *node) {
+    uint32_t record = coldRecordOf(accountNumber);
+    ColdRecord r;
+    if (record == 0 || pread(coldFd, &r, sizeof(r), (off_t)(record - 1) * (off_t)sizeof(r)) != (ssize_t)sizeof(r)) {
+        return 0;
+    }
+    r.name[sizeof(r.name) - 1] = '\0';
+    node->AccountNumber = r.accountNumber;
+    node->accountType = (AccountType)r.accountType;
+    node->Amount = r.amount;
+    node->Name = (char *)nameLookup(r.name);
+    node->displayRowValid = 0;
+    node->next = NULL;
+    if (node->Name == NULL) {
+        return 0;
+    }
+    node->keyHash = accountKeyHash(node);
+    return 1;
+}
+
+// Per-account concurrency metadata.
+// Writer locks and version counters live in a table of their own instead of next to Amount
+// in AccountNode, so that transactions on neighbouring accounts running on different cores
+// do not keep stealing the same cache line from each other. Account n uses stripe
+// n % stripeCount, and each stripe occupies stripeStride bytes: a whole cache line by
+// default, or less to pack more stripes per line (see --stripe-padding).
+#define CACHE_LINE_SIZE 64
+#define DEFAULT_STRIPE_COUNT 4096
+
+typedef struct AccountStripe {
+    uint32_t lock;      // 1 while a writer holds the stripe
+    uint32_t version;   // Bumped twice by every update: odd while the update is in progress
+} AccountStripe;
+
+unsigned char *stripeTable = NULL;      // stripeCount entries, stripeStride bytes apart
+uint32_t stripeCount = 0;               // A power of two
+uint32_t stripeStride = CACHE_LINE_SIZE;
+
+// Allocates a cache-line-aligned table of 'count' stripes, 'stride' bytes apart.
+// Returns 1 on success, 0 on failure.
+int stripesOpen(uint32_t count, uint32_t stride) {
+    if (count == 0 || (count & (count - 1)) != 0) {
+        fprintf(stderr, "The number of stripes must be a power of two\n");
+        return 0;
+    }
+    if (stride < sizeof(AccountStripe) || stride % sizeof(AccountStripe) != 0) {
+        fprintf(stderr, "Stripe padding must be a multiple of %zu bytes\n", sizeof(AccountStripe));
+        return 0;
+    }
+    void *table;
+    if (posix_memalign(&table, CACHE_LINE_SIZE, (size_t)count * stride) != 0) {
+        perror("Failed to allocate memory for account stripes");
+        return 0;
+    }
+    memset(table, 0, (size_t)count * stride);
+    free(stripeTable);
+    stripeTable = (unsigned char *)table;
+    stripeCount = count;
+    stripeStride = stride;
+    return 1;
+}
+
+// Releases the stripe table.
+void stripesClose(void) {
+    free(stripeTable);
+    stripeTable = NULL;
+    stripeCount = 0;
+}
+
+// Returns the stripe that guards the given account.
+AccountStripe *accountStripe(int accountNumber) {
+    return (AccountStripe *)(stripeTable + ((uint32_t)accountNumber & (stripeCount - 1)) * (size_t)stripeStride);
+}
+
+// Takes the writer lock of a stripe and marks an update as in progress.
+void stripeWriteBegin(AccountStripe *stripe) {
+    while (__atomic_exchange_n(&stripe->lock, 1, __ATOMIC_ACQUIRE) != 0) {
+        while (__atomic_load_n(&stripe->lock, __ATOMIC_RELAXED) != 0) {
+            sched_yield();
+        }
+    }
+    __atomic_store_n(&stripe->version, stripe->version + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+// Marks the update as complete and releases the writer lock.
+void stripeWriteEnd(AccountStripe *stripe) {
+    __atomic_store_n(&stripe->version, stripe->version + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&stripe->lock, 0, __ATOMIC_RELEASE);
+}
+
+// Arguments of one stripe benchmark thread.
+typedef struct StripeBenchThread {
+    int accountNumber;  // Account the thread keeps updating
+    long long updates;  // Number of updates to perform
+} StripeBenchThread;
+
+// Updates one account's stripe over and over, as a transaction would.
+void *stripeBenchWorker(void *arg) {
+    StripeBenchThread *t = (StripeBenchThread *)arg;
+    AccountStripe *stripe = accountStripe(t->accountNumber);
+    for (long long i = 0; i < t->updates; i++) {
+        stripeWriteBegin(stripe);
+        stripeWriteEnd(stripe);
+    }
+    return NULL;
+}
+
+// Measures stripe update throughput with packed and padded stripes, for threads that
+// update adjacent accounts (neighbouring stripes) or accounts a cache line's worth of
+// packed stripes apart, at 1, 2, 4, ... threads up to twice the number of cores.
+int benchStripes(long long updates) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int maxThreads = cores > 1 ? (int)cores * 2 : 2;
+    const uint32_t strides[] = {sizeof(AccountStripe), CACHE_LINE_SIZE};
+    const char *patterns[] = {"adjacent", "strided"};
+    printf("Stripe benchmark: %lld updates per thread, %ld core(s)\n", updates, cores);
+    printf("%-8s%-10s%-8s%s\n", "Padding", "Pattern", "Threads", "Mupdates/s");
+    for (int s = 0; s < 2; s++) {
+        if (!stripesOpen(DEFAULT_STRIPE_COUNT, strides[s])) {
+            return 1;
+        }
+        for (int p = 0; p < 2; p++) {
+            for (int threads = 1; threads <= maxThreads; threads *= 2) {
+                pthread_t tids[threads];
+                StripeBenchThread args[threads];
+                long long start = monotonicNanos();
+                int started = 0;
+                for (int i = 0; i < threads; i++) {
+                    int gap = p == 0 ? 1 : CACHE_LINE_SIZE / (int)sizeof(AccountStripe);
+                    args[i].accountNumber = FIRST_ACCOUNT_NUMBER + i * gap;
+                    args[i].updates = updates;
+                    if (pthread_create(&tids[i], NULL, stripeBenchWorker, &args[i]) != 0) {
+                        perror("Failed to start benchmark thread");
+                        break;
+                    }
+                    started++;
+                }
+                for (int i = 0; i < started; i++) {
+                    pthread_join(tids[i], NULL);
+                }
+                double seconds = (monotonicNanos() - start) / 1e9;
+                printf("%-8u%-10s%-8d%.1f\n", strides[s], patterns[p], started,
+                       seconds > 0 ? started * (double)updates / seconds / 1e6 : 0.0);
+            }
+        }
+    }
+    stripesClose();
+    return 0;
+}
+
+// Operational counters reported by STATS.
+typedef struct BankStats {
+    long long accounts;         // Accounts in the book
+    long long rowCacheHits;     // Report rows copied from the cache
+    long long rowCacheMisses;   // Report rows that had to be formatted
+    long long retiredNodes;     // Deleted blocks waiting for readers to move on
+    long long retiredBytes;     // Memory held by those blocks
+    long long reclaimedNodes;   // Deleted blocks freed so far
+    long long coldAccounts;     // Accounts evicted to the cold tier
+    long long coldEvictions;    // Accounts evicted so far
+    long long coldFaults;       // Evicted accounts brought back so far
+} BankStats;
+
+BankStats bankStats;
+
+// Epoch-based reclamation.
+// Lock-free readers (see readBalance()) may still be looking at an account that a writer has
+// just deleted, so deleted nodes are retired instead of freed. Readers announce the global
+// epoch they started in; a retired node is freed once every reader that is still active
+// started after it was retired. Readers pay one store and one fence per read, and retired
+// memory only piles up while a reader is stalled inside a read.
+// A thread claims a slot on its first read and gives it back when it exits, so the slots of
+// finished threads (such as those of closed connections) are used again.
+#define MAX_EPOCH_THREADS 256
+
+typedef struct EpochSlot {
+    _Alignas(CACHE_LINE_SIZE) uint64_t active; // Epoch the reader entered in, 0 when outside a read
+    uint32_t claimed;                          // Nonzero while a thread owns the slot
+} EpochSlot;
+
+EpochSlot epochSlots[MAX_EPOCH_THREADS];
+uint32_t epochSlotsUsed = 0;                    // Slots ever handed out; all later ones are unused
+uint64_t globalEpoch = 1;
+_Thread_local EpochSlot *epochSlot = NULL;      // This thread's slot, claimed on first read
+pthread_key_t epochSlotKey;                     // Releases the slot when its thread exits
+pthread_once_t epochSlotKeyOnce = PTHREAD_ONCE_INIT;
+
+// Gives the slot of an exiting thread back. The thread is outside any read, so it is idle.
+void epochSlotRelease(void *slot) {
+    __atomic_store_n(&((EpochSlot *)slot)->claimed, 0, __ATOMIC_RELEASE);
+}
+
+void epochSlotKeyCreate(void) {
+    pthread_key_create(&epochSlotKey, epochSlotRelease);
+}
+
+// Claims a slot for this thread, preferring one given back by a thread that exited.
+// Returns NULL if every slot is taken.
+EpochSlot *epochSlotClaim(void) {
+    pthread_once(&epochSlotKeyOnce, epochSlotKeyCreate);
+    while (1) {
+        uint32_t used = __atomic_load_n(&epochSlotsUsed, __ATOMIC_ACQUIRE);
+        for (uint32_t i = 0; i < used; i++) {
+            uint32_t expected = 0;
+            if (__atomic_compare_exchange_n(&epochSlots[i].claimed, &expected, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                pthread_setspecific(epochSlotKey, &epochSlots[i]);
+                return &epochSlots[i];
+            }
+        }
+        if (used >= MAX_EPOCH_THREADS) {
+            return NULL;
+        }
+        // Hand out one more slot and race for it like for any other free one
+        __atomic_compare_exchange_n(&epochSlotsUsed, &used, used + 1, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+    }
+}
+
+// Marks the start of a lock-free read by this thread.
+// Returns 1 on success, 0 if every slot is taken (the caller must read under bankLock).
+int epochEnter(void) {
+    if (epochSlot == NULL && (epochSlot = epochSlotClaim()) == NULL) {
+        return 0;
+    }
+    __atomic_store_n(&epochSlot->active, __atomic_load_n(&globalEpoch, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST); // Announce the epoch before touching any node
+    return 1;
+}
+
+// Marks the end of the lock-free read.
+void epochExit(void) {
+    __atomic_store_n(&epochSlot->active, 0, __ATOMIC_RELEASE);
+}
+
+// Memory waiting to be freed, oldest first. Only touched with bankLock held.
+typedef struct RetiredNode {
+    void *memory;               // Unlinked block that readers may still hold
+    void (*release)(void *);    // Frees the block
+    size_t bytes;               // Memory held by the block
+    uint64_t epoch;             // Global epoch when the block was retired
+    struct RetiredNode *next;
+} RetiredNode;
+
+RetiredNode *retiredHead = NULL;
+RetiredNode **retiredTail = &retiredHead;
+
+// Frees the retired blocks that no active reader can still hold.
+void epochReclaim(void) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST); // Unlinking happens before looking at the readers
+    uint64_t oldest = UINT64_MAX;
+    uint32_t used = __atomic_load_n(&epochSlotsUsed, __ATOMIC_RELAXED);
+    for (uint32_t i = 0; i < used && i < MAX_EPOCH_THREADS; i++) {
+        uint64_t active = __atomic_load_n(&epochSlots[i].active, __ATOMIC_ACQUIRE);
+        if (active != 0 && active < oldest) {
+            oldest = active;
+        }
+    }
+    while (retiredHead != NULL && retiredHead->epoch < oldest) {
+        RetiredNode *r = retiredHead;
+        retiredHead = r->next;
+        bankStats.retiredNodes--;
+        bankStats.retiredBytes -= (long long)r->bytes;
+        bankStats.reclaimedNodes++;
+        r->release(r->memory);
+        free(r);
+    }
+    if (retiredHead == NULL) {
+        retiredTail = &retiredHead;
+    }
+}
+
+// Hands an unlinked block over to be released once no reader can hold it.
+void retireMemory(void *memory, size_t bytes, void (*release)(void *)) {
+    RetiredNode *r = (RetiredNode *)malloc(sizeof(RetiredNode));
+    if (!r) {
+        perror("Failed to allocate memory for retired block");
+        return; // Leak the block rather than free it under a reader
+    }
+    r->memory = memory;
+    r->release = release;
+    r->bytes = bytes;
+    r->epoch = __atomic_fetch_add(&globalEpoch, 1, __ATOMIC_SEQ_CST); // Later readers start in a newer epoch
+    r->next = NULL;
+    *retiredTail = r;
+    retiredTail = &r->next;
+    bankStats.retiredNodes++;
+    bankStats.retiredBytes += (long long)bytes;
+    epochReclaim();
+}
+
+// Releases every retired block. Only for shutdown, when no reader is left.
+void epochFreeAll(void) {
+    while (retiredHead != NULL) {
+        RetiredNode *r = retiredHead;
+        retiredHead = r->next;
+        r->release(r->memory);
+        free(r);
+    }
+    retiredTail = &retiredHead;
+    bankStats.retiredNodes = 0;
+    bankStats.retiredBytes = 0;
+}
+
+// Account stores.
+// By default the book is the account list, kept in creation order, so reports have to sort
+// it first (see orderAccounts()). An ordered store keeps the accounts keyed on their number
+// instead and leaves the list empty: reports walk it in order, transaction() looks accounts
+// up in it and deleteAccount() searches it (--store).
+typedef enum StoreKind {
+    STORE_LIST,         // Account list, sorted lazily for reports
+    STORE_SKIPLIST,     // Lock-free skip list
+    STORE_BTREE         // B+-tree with wide, cache-line-aligned nodes
+} StoreKind;
+
+StoreKind accountStore = STORE_LIST;
+
+// Lock-free skip list.
+// Follows the lock-free skip list of Herlihy and Shavit. A node is deleted by marking the low
+// bit of its next pointers, top level first; whichever thread next walks past a marked node
+// unlinks it. Inserts and deletes only use compare-and-swap, so they can run concurrently,
+// while lookups and in-order walks never write and never retry. Unlinked nodes are retired
+// (see retireMemory()) since a walk may still be on them.
+#define SKIP_MAX_LEVEL 24
+#define SKIP_MARK ((uintptr_t)1)
+
+typedef struct SkipNode {
+    int key;                    // Account number; INT_MIN and INT_MAX for the sentinels
+    int height;                 // Number of levels the node is linked on
+    AccountNode *account;       // Account with this number
+    uintptr_t next[];           // Successor on each level, low bit set once the node is deleted
+} SkipNode;
+
+typedef struct SkipList {
+    SkipNode *head;             // Sentinel before the smallest key
+    SkipNode *tail;             // Sentinel after the largest key
+} SkipList;
+
+SkipList accountSkipList;       // Skip list over the live book (STORE_SKIPLIST)
+
+_Thread_local uint64_t skipRandomState = 0;
+
+// Returns the number of bytes a skip list node of the given height occupies.
+size_t skipNodeSize(int height) {
+    return sizeof(SkipNode) + (size_t)height * sizeof(uintptr_t);
+}
+
+// Allocates a skip list node. Returns NULL on allocation failure.
+SkipNode *skipNodeNew(int key, int height, AccountNode *account) {
+    SkipNode *node = (SkipNode *)malloc(skipNodeSize(height));
+    if (!node) {
+        perror("Failed to allocate memory for skip list node");
+        return NULL;
+    }
+    node->key = key;
+    node->height = height;
+    node->account = account;
+    return node;
+}
+
+// Picks the height of a new node: each further level with probability 1/4.
+int skipRandomHeight(void) {
+    if (skipRandomState == 0) {
+        skipRandomState = mix64((uint64_t)(uintptr_t)&skipRandomState ^ (uint64_t)monotonicNanos()) | 1;
+    }
+    skipRandomState ^= skipRandomState << 13;
+    skipRandomState ^= skipRandomState >> 7;
+    skipRandomState ^= skipRandomState << 17;
+    uint64_t bits = skipRandomState;
+    int height = 1;
+    while (height < SKIP_MAX_LEVEL && (bits & 3) == 0) {
+        height++;
+        bits >>= 2;
+    }
+    return height;
+}
+
+// Creates an empty skip list. Returns 1 on success, 0 on failure.
+int skipListInit(SkipList *list) {
+    list->head = skipNodeNew(INT_MIN, SKIP_MAX_LEVEL, NULL);
+    list->tail = skipNodeNew(INT_MAX, SKIP_MAX_LEVEL, NULL);
+    if (!list->head || !list->tail) {
+        free(list->head);
+        free(list->tail);
+        list->head = list->tail = NULL;
+        return 0;
+    }
+    for (int level = 0; level < SKIP_MAX_LEVEL; level++) {
+        list->head->next[level] = (uintptr_t)list->tail;
+        list->tail->next[level] = 0;
+    }
+    return 1;
+}
+
+// Frees every node of a skip list, sentinels included. The accounts are not touched.
+void skipListFree(SkipList *list) {
+    SkipNode *node = list->head;
+    while (node != NULL) {
+        SkipNode *next = (SkipNode *)(node->next[0] & ~SKIP_MARK);
+        free(node);
+        node = next;
+    }
+    list->head = list->tail = NULL;
+}
+
+// Finds the nodes around 'key' on every level, unlinking deleted nodes on the way.
+// Returns 1 if succs[0] holds the key.
+int skipFind(SkipList *list, int key, SkipNode **preds, SkipNode **succs) {
+retry:
+    {
+        SkipNode *pred = list->head;
+        for (int level = SKIP_MAX_LEVEL - 1; level >= 0; level--) {
+            SkipNode *curr = (SkipNode *)(__atomic_load_n(&pred->next[level], __ATOMIC_ACQUIRE) & ~SKIP_MARK);
+            while (1) {
+                uintptr_t succ = __atomic_load_n(&curr->next[level], __ATOMIC_ACQUIRE);
+                while (succ & SKIP_MARK) {
+                    // curr is deleted: unlink it from this level, or start over if pred changed
+                    uintptr_t expected = (uintptr_t)curr;
+                    if (!__atomic_compare_exchange_n(&pred->next[level], &expected, succ & ~SKIP_MARK, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                        goto retry;
+                    }
+                    curr = (SkipNode *)(succ & ~SKIP_MARK);
+                    succ = __atomic_load_n(&curr->next[level], __ATOMIC_ACQUIRE);
+                }
+                if (curr->key >= key) {
+                    break;
+                }
+                pred = curr;
+                curr = (SkipNode *)succ;
+            }
+            preds[level] = pred;
+            succs[level] = curr;
+        }
+        return succs[0]->key == key;
+    }
+}
+
+// Adds an account to the skip list.
+// Returns 1 if it was added, 0 if its number was already present or memory ran out.
+int skipListInsert(SkipList *list, AccountNode *account) {
+    int key = account->AccountNumber;
+    int height = skipRandomHeight();
+    SkipNode *preds[SKIP_MAX_LEVEL];
+    SkipNode *succs[SKIP_MAX_LEVEL];
+    SkipNode *node = NULL;
+    while (1) {
+        if (skipFind(list, key, preds, succs)) {
+            free(node);
+            return 0;
+        }
+        if (node == NULL && (node = skipNodeNew(key, height, account)) == NULL) {
+            return 0;
+        }
+        for (int level = 0; level < height; level++) {
+            __atomic_store_n(&node->next[level], (uintptr_t)succs[level], __ATOMIC_RELAXED);
+        }
+        // Linking the bottom level makes the node part of the list
+        uintptr_t expected = (uintptr_t)succs[0];
+        if (__atomic_compare_exchange_n(&preds[0]->next[0], &expected, (uintptr_t)node, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+    // The upper levels only speed up searches; link them one by one
+    for (int level = 1; level < height; level++) {
+        while (1) {
+            uintptr_t expected = (uintptr_t)succs[level];
+            if (__atomic_compare_exchange_n(&preds[level]->next[level], &expected, (uintptr_t)node, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+                break;
+            }
+            skipFind(list, key, preds, succs);
+            uintptr_t own = __atomic_load_n(&node->next[level], __ATOMIC_ACQUIRE);
+            if (own & SKIP_MARK) {
+                return 1; // Deleted meanwhile: do not link it any higher
+            }
+            if (own != (uintptr_t)succs[level] &&
+                !__atomic_compare_exchange_n(&node->next[level], &own, (uintptr_t)succs[level], 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+                return 1;
+            }
+        }
+    }
+    return 1;
+}
+
+// Removes the account with the given number from the skip list.
+// Returns the unlinked node, which must be retired rather than freed, or NULL if the
+// number was not present or another thread removed it first.
+SkipNode *skipListRemove(SkipList *list, int key) {
+    SkipNode *preds[SKIP_MAX_LEVEL];
+    SkipNode *succs[SKIP_MAX_LEVEL];
+    if (!skipFind(list, key, preds, succs)) {
+        return NULL;
+    }
+    SkipNode *victim = succs[0];
+    for (int level = victim->height - 1; level >= 1; level--) {
+        uintptr_t succ = __atomic_load_n(&victim->next[level], __ATOMIC_ACQUIRE);
+        while (!(succ & SKIP_MARK)) {
+            __atomic_compare_exchange_n(&victim->next[level], &succ, succ | SKIP_MARK, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+        }
+    }
+    // Marking the bottom level is the actual delete; whoever does it owns the node
+    uintptr_t succ = __atomic_load_n(&victim->next[0], __ATOMIC_ACQUIRE);
+    while (1) {
+        if (succ & SKIP_MARK) {
+            return NULL;
+        }
+        if (__atomic_compare_exchange_n(&victim->next[0], &succ, succ | SKIP_MARK, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            skipFind(list, key, preds, succs); // Unlink it from every level
+            return victim;
+        }
+    }
+}
+
+// Returns the account with the given number, or NULL if there is none. Never writes.
+AccountNode *skipListFind(SkipList *list, int key) {
+    SkipNode *pred = list->head;
+    SkipNode *curr = NULL;
+    for (int level = SKIP_MAX_LEVEL - 1; level >= 0; level--) {
+        curr = (SkipNode *)(__atomic_load_n(&pred->next[level], __ATOMIC_ACQUIRE) & ~SKIP_MARK);
+        while (1) {
+            uintptr_t succ = __atomic_load_n(&curr->next[level], __ATOMIC_ACQUIRE);
+            while (succ & SKIP_MARK) {
+                curr = (SkipNode *)(succ & ~SKIP_MARK);
+                succ = __atomic_load_n(&curr->next[level], __ATOMIC_ACQUIRE);
+            }
+            if (curr->key >= key) {
+                break;
+            }
+            pred = curr;
+            curr = (SkipNode *)succ;
+        }
+    }
+    if (curr->key != key || (__atomic_load_n(&curr->next[0], __ATOMIC_ACQUIRE) & SKIP_MARK)) {
+        return NULL;
+    }
+    return curr->account;
+}
+
+// Returns the first live node after 'node' on the bottom level, or NULL at the end.
+SkipNode *skipListNext(SkipList *list, SkipNode *node) {
+    SkipNode *next = (SkipNode *)(__atomic_load_n(&node->next[0], __ATOMIC_ACQUIRE) & ~SKIP_MARK);
+    while (next != list->tail && (__atomic_load_n(&next->next[0], __ATOMIC_ACQUIRE) & SKIP_MARK)) {
+        next = (SkipNode *)(next->next[0] & ~SKIP_MARK);
+    }
+    return next == list->tail ? NULL : next;
+}
+
+// Cache-conscious B+-tree.
+// Nodes hold BTREE_FANOUT keys in a cache-line-aligned array; unused slots hold INT_MAX, so a
+// node is searched by comparing the key against the whole array, four keys per SIMD compare
+// (SSE2), without branches. Accounts sit in the leaves, which are linked for in-order walks.
+// Deletes do not rebalance: freed numbers are recycled smallest first and fill the gaps again.
+#define BTREE_FANOUT 32
+
+typedef struct BTreeNode {
+    _Alignas(CACHE_LINE_SIZE) int keys[BTREE_FANOUT];   // Sorted, INT_MAX past 'count'
+    int count;                  // Keys in use
+    int leaf;                   // 1 for leaves
+    struct BTreeNode *next;     // Next leaf (leaves only)
+    union {
+        struct BTreeNode *children[BTREE_FANOUT + 1];   // Child i holds keys below keys[i]
+        AccountNode *accounts[BTREE_FANOUT];            // Account of keys[i]
+    };
+} BTreeNode;
+
+BTreeNode *accountBTree = NULL; // B+-tree over the live book (STORE_BTREE)
+
+// Returns how many keys of a node are less than 'key'.
+int btreeRank(const int *keys, int key) {
+#ifdef __SSE2__
+    __m128i target = _mm_set1_epi32(key);
+    int rank = 0;
+    for (int i = 0; i < BTREE_FANOUT; i += 4) {
+        __m128i less = _mm_cmplt_epi32(_mm_load_si128((const __m128i *)(keys + i)), target);
+        rank += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(less)));
+    }
+    return rank;
+#else
+    int rank = 0;
+    for (int i = 0; i < BTREE_FANOUT; i++) {
+        rank += keys[i] < key;
+    }
+    return rank;
+#endif
+}
+
+// Allocates an empty node. Returns NULL on allocation failure.
+BTreeNode *btreeNodeNew(int leaf) {
+    void *memory;
+    if (posix_memalign(&memory, CACHE_LINE_SIZE, sizeof(BTreeNode)) != 0) {
+        perror("Failed to allocate memory for B+-tree node");
+        return NULL;
+    }
+    BTreeNode *node = (BTreeNode *)memory;
+    memset(node, 0, sizeof(BTreeNode));
+    for (int i = 0; i < BTREE_FANOUT; i++) {
+        node->keys[i] = INT_MAX;
+    }
+    node->leaf = leaf;
+    return node;
+}
+
+// Nodes allocated ahead of an insert, chained through 'next'. btreeInsert() makes sure there
+// is one for every node the insert could split plus a new root before it changes anything,
+// so a split never runs out of memory halfway and leaves part of the tree unreachable.
+BTreeNode *btreeSpares = NULL;
+int btreeSpareCount = 0;
+
+// Sets aside nodes until there are 'count'. Returns 1 on success, 0 if memory ran out.
+int btreeReserve(int count) {
+    while (btreeSpareCount < count) {
+        BTreeNode *node = btreeNodeNew(0);
+        if (node == NULL) {
+            return 0;
+        }
+        node->next = btreeSpares;
+        btreeSpares = node;
+        btreeSpareCount++;
+    }
+    return 1;
+}
+
+// Takes a node set aside by btreeReserve() and makes it an empty node.
+BTreeNode *btreeSpareTake(int leaf) {
+    BTreeNode *node = btreeSpares;
+    btreeSpares = node->next;
+    btreeSpareCount--;
+    node->next = NULL;
+    node->leaf = leaf;
+    return node;
+}
+
+// Frees the nodes set aside by btreeReserve().
+void btreeSparesFree(void) {
+    while (btreeSpares != NULL) {
+        BTreeNode *next = btreeSpares->next;
+        free(btreeSpares);
+        btreeSpares = next;
+    }
+    btreeSpareCount = 0;
+}
+
+// Frees a subtree. The accounts are not touched.
+void btreeFree(BTreeNode *node) {
+    if (node == NULL) {
+        return;
+    }
+    if (!node->leaf) {
+        for (int i = 0; i <= node->count; i++) {
+            btreeFree(node->children[i]);
+        }
+    }
+    free(node);
+}
+
+// Returns the leaf that holds, or would hold, 'key'.
+BTreeNode *btreeFindLeaf(BTreeNode *node, int key) {
+    while (!node->leaf) {
+        node = node->children[btreeRank(node->keys, key + 1)]; // Keys up to and including 'key'
+    }
+    return node;
+}
+
+// Returns the account with the given number, or NULL if there is none.
+AccountNode *btreeFind(BTreeNode *root, int key) {
+    if (root == NULL) {
+        return NULL;
+    }
+    BTreeNode *leaf = btreeFindLeaf(root, key);
+    int pos = btreeRank(leaf->keys, key);
+    return pos < leaf->count && leaf->keys[pos] == key ? leaf->accounts[pos] : NULL;
+}
+
+// Inserts into the subtree under 'node'. If the node had to split, the new right sibling is
+// stored in *split and the smallest key under it in *splitKey. Splits take their nodes from
+// the spares, which must hold one per level below and including 'node'.
+// Returns 1 if inserted, 0 if the key was already present.
+int btreeInsertInto(BTreeNode *node, int key, AccountNode *account, BTreeNode **split, int *splitKey) {
+    *split = NULL;
+    if (node->leaf) {
+        int pos = btreeRank(node->keys, key);
+        if (pos < node->count && node->keys[pos] == key) {
+            return 0;
+        }
+        if (node->count == BTREE_FANOUT) {
+            // Full: move the upper half to a new leaf, then insert into the proper half
+            BTreeNode *right = btreeSpareTake(1);
+            int half = BTREE_FANOUT / 2;
+            memcpy(right->keys, node->keys + half, (BTREE_FANOUT - half) * sizeof(int));
+            memcpy(right->accounts, node->accounts + half, (BTREE_FANOUT - half) * sizeof(AccountNode *));
+            right->count = BTREE_FANOUT - half;
+            for (int i = half; i < BTREE_FANOUT; i++) {
+                node->keys[i] = INT_MAX;
+            }
+            node->count = half;
+            right->next = node->next;
+            node->next = right;
+            if (pos > half) {
+                node = right;
+                pos -= half;
+            }
+            *split = right;
+        }
+        memmove(node->keys + pos + 1, node->keys + pos, (node->count - pos) * sizeof(int));
+        memmove(node->accounts + pos + 1, node->accounts + pos, (node->count - pos) * sizeof(AccountNode *));
+        node->keys[pos] = key;
+        node->accounts[pos] = account;
+        node->count++;
+        if (*split != NULL) {
+            *splitKey = (*split)->keys[0];
+        }
+        return 1;
+    }
+
+    int child = btreeRank(node->keys, key + 1);
+    BTreeNode *childSplit;
+    int childSplitKey;
+    int inserted = btreeInsertInto(node->children[child], key, account, &childSplit, &childSplitKey);
+    if (childSplit == NULL) {
+        return inserted;
+    }
+    // Add the new child after 'child', splitting this node first if it is full
+    int keys[BTREE_FANOUT + 1];
+    BTreeNode *children[BTREE_FANOUT + 2];
+    memcpy(keys, node->keys, node->count * sizeof(int));
+    memcpy(children, node->children, (node->count + 1) * sizeof(BTreeNode *));
+    memmove(keys + child + 1, keys + child, (node->count - child) * sizeof(int));
+    memmove(children + child + 2, children + child + 1, (node->count - child) * sizeof(BTreeNode *));
+    keys[child] = childSplitKey;
+    children[child + 1] = childSplit;
+    int total = node->count + 1;
+    if (total <= BTREE_FANOUT) {
+        memcpy(node->keys, keys, total * sizeof(int));
+        memcpy(node->children, children, (total + 1) * sizeof(BTreeNode *));
+        node->count = total;
+        return inserted;
+    }
+    BTreeNode *right = btreeSpareTake(0);
+    int half = total / 2; // keys[half] moves up to the parent
+    for (int i = 0; i < BTREE_FANOUT; i++) {
+        node->keys[i] = i < half ? keys[i] : INT_MAX;
+    }
+    memcpy(node->children, children, (half + 1) * sizeof(BTreeNode *));
+    node->count = half;
+    memcpy(right->keys, keys + half + 1, (total - half - 1) * sizeof(int));
+    memcpy(right->children, children + half + 1, (total - half) * sizeof(BTreeNode *));
+    right->count = total - half - 1;
+    *split = right;
+    *splitKey = keys[half];
+    return inserted;
+}
+
+// Adds an account to the tree. Returns 1 if it was added, 0 if not; if memory ran out, the
+// tree is left as it was.
+int btreeInsert(BTreeNode **root, AccountNode *account) {
+    if (*root == NULL && (*root = btreeNodeNew(1)) == NULL) {
+        return 0;
+    }
+    int height = 1;
+    for (BTreeNode *node = *root; !node->leaf; node = node->children[0]) {
+        height++;
+    }
+    if (!btreeReserve(height + 1)) { // A split on every level and a new root
+        return 0;
+    }
+    BTreeNode *split;
+    int splitKey;
+    int inserted = btreeInsertInto(*root, account->AccountNumber, account, &split, &splitKey);
+    if (split != NULL) {
+        BTreeNode *newRoot = btreeSpareTake(0);
+        newRoot->keys[0] = splitKey;
+        newRoot->children[0] = *root;
+        newRoot->children[1] = split;
+        newRoot->count = 1;
+        *root = newRoot;
+    }
+    return inserted == 1;
+}
+
+// Removes the account with the given number from its leaf. Returns 1 if it was there.
+int btreeRemove(BTreeNode *root, int key) {
+    if (root == NULL) {
+        return 0;
+    }
+    BTreeNode *leaf = btreeFindLeaf(root, key);
+    int pos = btreeRank(leaf->keys, key);
+    if (pos >= leaf->count || leaf->keys[pos] != key) {
+        return 0;
+    }
+    memmove(leaf->keys + pos, leaf->keys + pos + 1, (leaf->count - pos - 1) * sizeof(int));
+    memmove(leaf->accounts + pos, leaf->accounts + pos + 1, (leaf->count - pos - 1) * sizeof(AccountNode *));
+    leaf->count--;
+    leaf->keys[leaf->count] = INT_MAX;
+    return 1;
+}
+
+// Returns the leftmost leaf of a tree, or NULL if the tree is empty.
+BTreeNode *btreeFirstLeaf(BTreeNode *node) {
+    while (node != NULL && !node->leaf) {
+        node = node->children[0];
+    }
+    return node;
+}
+
+// Sets up the selected store. Returns 1 on success, 0 on failure.
+int storeOpen(StoreKind kind) {
+    accountStore = kind;
+    if (kind == STORE_SKIPLIST) {
+        return skipListInit(&accountSkipList);
+    }
+    return 1;
+}
+
+// Releases the selected store. The accounts themselves are freed by freeBank().
+void storeClose(void) {
+    if (accountStore == STORE_SKIPLIST) {
+        skipListFree(&accountSkipList);
+    } else if (accountStore == STORE_BTREE) {
+        btreeFree(accountBTree);
+        btreeSparesFree();
+        accountBTree = NULL;
+    }
+}
+
+// Converts a store name (list, skiplist or btree). Returns 1 on success, 0 if unknown.
+int parseStoreKind(const char *str, StoreKind *kind) {
+    if (strcmp(str, "list") == 0) {
+        *kind = STORE_LIST;
+    } else if (strcmp(str, "skiplist") == 0) {
+        *kind = STORE_SKIPLIST;
+    } else if (strcmp(str, "btree") == 0) {
+        *kind = STORE_BTREE;
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+// Returns the account with the given number, looked up in the selected store.
+AccountNode *storeFind(int accountNumber) {
+    if (accountStore == STORE_SKIPLIST) {
+        return skipListFind(&accountSkipList, accountNumber);
+    }
+    if (accountStore == STORE_BTREE) {
+        return btreeFind(accountBTree, accountNumber);
+    }
+    return findAccountByNumber(accountNumber);
+}
+
+// Position of a walk over accounts.
+typedef struct AccountCursor {
+    AccountNode *listNode;      // Next account of a list walk
+    SkipNode *skipNode;         // Next node of a skip list walk
+    BTreeNode *leaf;            // Current leaf of a B+-tree walk
+    int slot;                   // Next slot in that leaf
+    uint32_t packedSlot;        // Next packed record of a packed scan
+    int packedScan;             // Set for a walk over the packed records (see packedScan())
+    uint32_t packedWant;        // PACKED_* flags the records of a packed scan must have
+} AccountCursor;
+
+// Returns a cursor that walks a list from its head.
+AccountCursor listCursor(AccountList list) {
+    AccountCursor cursor = {list, NULL, NULL, 0, 0, 0, 0};
+    return cursor;
+}
+
+// Returns the next account of a walk and advances the cursor, or NULL at the end.
+AccountNode *cursorNext(AccountCursor *cursor) {
+    if (cursor->packedScan) {
+        while (cursor->packedSlot < packedHighWater) {
+            uint32_t flags = packedTable[cursor->packedSlot++].numberFlags;
+            if (flags == 0 || (flags & (cursor->packedWant | PACKED_TOMBSTONE)) != cursor->packedWant) {
+                continue;
+            }
+            int accountNumber = (int)(flags & PACKED_NUMBER_MASK);
+            AccountNode *account = findAccountByNumber(accountNumber);
+            if (account != NULL) {
+                return account;
+            }
+            if (coldPeek(accountNumber, &coldScratch)) {
+                if (coldScratch.displayRow == NULL) {
+                    // First use on this thread; reports cache their row in the scratch copy
+                    pthread_once(&coldScratchKeyOnce, coldScratchKeyCreate);
+                    pthread_setspecific(coldScratchKey, &coldScratch);
+                }
+                return &coldScratch; // Evicted: read back, valid until the next call
+            }
+        }
+        return NULL;
+    }
+    if (cursor->leaf != NULL) {
+        while (cursor->leaf != NULL && cursor->slot >= cursor->leaf->count) {
+            cursor->leaf = cursor->leaf->next; // Deletes may leave leaves empty
+            cursor->slot = 0;
+        }
+        return cursor->leaf != NULL ? cursor->leaf->accounts[cursor->slot++] : NULL;
+    }
+    if (cursor->skipNode != NULL) {
+        AccountNode *account = cursor->skipNode->account;
+        cursor->skipNode = skipListNext(&accountSkipList, cursor->skipNode);
+        return account;
+    }
+    AccountNode *account = cursor->listNode;
+    if (account != NULL) {
+        cursor->listNode = account->next;
+    }
+    return account;
+}
+
+// Returns a cursor over every account of the book: in account number order for the
+// ordered stores, in list order (not necessarily sorted) for the account list.
+AccountCursor allAccounts(void) {
+    AccountCursor cursor = listCursor(accountsHead);
+    if (accountStore == STORE_SKIPLIST) {
+        cursor.skipNode = skipListNext(&accountSkipList, accountSkipList.head);
+    } else if (accountStore == STORE_BTREE) {
+        cursor.leaf = btreeFirstLeaf(accountBTree);
+    }
+    return cursor;
+}
+
+// Returns a cursor over the accounts whose packed records have all the 'want' flags, in
+// account number order, evicted accounts included. It scans the packed records rather
+// than the accounts themselves.
+AccountCursor packedScan(uint32_t want) {
+    AccountCursor cursor = listCursor(NULL);
+    cursor.packedScan = 1;
+    cursor.packedWant = want;
+    return cursor;
+}
+
+// Returns a cursor over the accounts whose balance is below the low-balance limit of their
+// type, in account number order.
+AccountCursor lowBalanceCandidates(void) {
+    return packedScan(PACKED_LOW_BALANCE);
+}
+
+// Recomputes the fingerprint from scratch; used to check the incremental one.
+uint64_t recomputeStateHash(void) {
+    uint64_t sum = 0;
+    AccountCursor cursor = bankStats.coldAccounts > 0 ? packedScan(0) : allAccounts();
+    for (AccountNode *node; (node = cursorNext(&cursor)) != NULL;) {
+        uint32_t amountBits;
+        memcpy(&amountBits, &node->Amount, sizeof(amountBits));
+        sum += mix64(accountKeyHash(node) ^ ((uint64_t)amountBits << 1));
+    }
+    return sum;
+}
+
+// Change notifications.
+// Every mutation of the book reports here so that derived structures stay in sync.
+
+// Makes an account reachable through the index and the selected ordered store.
+// Returns 0 on success, -1 if memory ran out; then the account is reachable through neither.
+int storeLink(AccountNode *node) {
+    if (indexSet(node->AccountNumber, node) != 0) {
+        return -1;
+    }
+    int linked = 1;
+    if (accountStore == STORE_SKIPLIST) {
+        linked = skipListInsert(&accountSkipList, node);
+    } else if (accountStore == STORE_BTREE) {
+        linked = btreeInsert(&accountBTree, node);
+    }
+    if (!linked) {
+        indexSet(node->AccountNumber, NULL);
+        return -1;
+    }
+    return 0;
+}
+
+// Removes an account from the index and the selected ordered store.
+void storeUnlink(AccountNode *node) {
+    // Bump the version so that optimistic readers that already found the node retry
+    AccountStripe *stripe = accountStripe(node->AccountNumber);
+    stripeWriteBegin(stripe);
+    indexSet(node->AccountNumber, NULL);
+    stripeWriteEnd(stripe);
+    if (accountStore == STORE_SKIPLIST) {
+        SkipNode *gone = skipListRemove(&accountSkipList, node->AccountNumber);
+        if (gone != NULL) {
+            retireMemory(gone, skipNodeSize(gone->height), free);
+        }
+    } else if (accountStore == STORE_BTREE) {
+        btreeRemove(accountBTree, node->AccountNumber);
+    }
+}
+
+// Called after a new account has been linked into the book. Returns 0, or -1 if the account
+// could not be recorded (its number is above MAX_ACCOUNT_NUMBER or memory ran out); then
+// nothing has changed and the caller must take the account back out and free it.
+int accountCreated(AccountNode *node) {
+    if (packedAdd(node->AccountNumber, node->Name, node->accountType, node->Amount) != 0) {
+        return -1;
+    }
+    if (activityTouch(node->AccountNumber) != 0) {
+        packedRemove(node->AccountNumber);
+        return -1;
+    }
+    if (storeLink(node) != 0) {
+        activityForget(node->AccountNumber);
+        packedRemove(node->AccountNumber);
+        return -1;
+    }
+    bankStats.accounts++;
+    node->displayRow = NULL;
+    node->displayRowValid = 0;
+    balanceIntegralUpdate(node->AccountNumber, node->Amount);
+    nameEntry(node->Name)->accounts[node->accountType] = node->AccountNumber;
+    node->keyHash = accountKeyHash(node);
+    bookFingerprint += accountHash(node);
+    merkleAdd(&liveMerkle, node->AccountNumber, accountHash(node));
+    replicaPublishAccount(node);
+    walLogCreate(node);
+    return 0;
+}
+
+// Called after the balance of an account changed from 'oldAmount' to node->Amount.
+void balanceChanged(AccountNode *node, float oldAmount) {
+    node->displayRowValid = 0;
+    packedSetBalance(node->AccountNumber, node->Amount);
+    if (activityTouch(node->AccountNumber) != 0) {
+        activityForget(node->AccountNumber); // Unknown rather than stale, so it is not evicted
+    }
+    balanceIntegralUpdate(node->AccountNumber, node->Amount);
+    bookFingerprint += accountHash(node) - accountHashWithAmount(node, oldAmount);
+    merkleAdd(&liveMerkle, node->AccountNumber, accountHash(node) - accountHashWithAmount(node, oldAmount));
+    replicaPublishBalance(node);
+    walLogBalance(node);
+}
+
+// Called just before an account is unlinked and freed.
+void accountDeleted(AccountNode *node) {
+    bankStats.accounts--;
+    storeUnlink(node);
+    packedRemove(node->AccountNumber);
+    activityForget(node->AccountNumber);
+    balanceIntegralForget(node->AccountNumber);
+    if (loanBook.count > 0 && node->accountType == CURRENT) {
+        loanAccountDeleted(node->AccountNumber);
+    }
+    InternedName *entry = nameEntry(node->Name);
+    if (entry->accounts[node->accountType] == node->AccountNumber) {
+        entry->accounts[node->accountType] = 0;
+    }
+    bookFingerprint -= accountHash(node);
+    merkleAdd(&liveMerkle, node->AccountNumber, -accountHash(node));
+    replicaRemove(node->AccountNumber);
+    walLogDelete(node->AccountNumber);
+}
+
+// Frees an account node together with its name and cached report row.
+void freeAccountNode(AccountNode *node) {
+    nameRelease(node->Name);
+    free(node->displayRow);
+    poolFree(&accountPool, node);
+}
+
+// Frees a retired account node (see retireMemory()).
+void releaseAccountNode(void *memory) {
+    freeAccountNode((AccountNode *)memory);
+}
+
+// Retires an unlinked account node: it is freed once no lock-free reader can hold it.
+// The name is interned and shared, so its bytes are not counted as awaiting reclamation.
+void retireAccountNode(AccountNode *node) {
+    retireMemory(node, sizeof(AccountNode) + (node->displayRow ? node->displayRowLength + 1u : 0), releaseAccountNode);
+}
+
+// Eviction and faults.
+
+// Full pages of records being appended to the cold store file.
+typedef struct ColdWriter {
+    ColdRecord page[COLD_RECORDS_PER_PAGE];
+    uint32_t first;             // Record number of page[0]
+    uint32_t fill;              // Records in 'page'
+} ColdWriter;
+
+// Marks the account slots of the records in a writer as evicted once they are on disk.
+// If the write failed the accounts stay resident and the records are left unused.
+void coldWriterFlush(ColdWriter *w) {
+    if (w->fill == 0) {
+        return;
+    }
+    size_t bytes = w->fill * sizeof(ColdRecord);
+    if (pwrite(coldFd, w->page, bytes, (off_t)w->first * (off_t)sizeof(ColdRecord)) != (ssize_t)bytes) {
+        perror("Failed to write to the cold store");
+    } else {
+        for (uint32_t i = 0; i < w->fill; i++) {
+            coldSlots[w->page[i].accountNumber - FIRST_ACCOUNT_NUMBER] = w->first + i + 1;
+        }
+    }
+    w->fill = 0;
+}
+
+// Writes the contents of an account to the cold store: into a free record right away, or
+// appended through the writer. Returns 1 if the account can be evicted, 0 if not.
+int coldWrite(ColdWriter *w, const AccountNode *node) {
+    uint32_t slot = (uint32_t)(node->AccountNumber - FIRST_ACCOUNT_NUMBER);
+    ColdRecord r;
+    memset(&r, 0, sizeof(r));
+    if (strlen(node->Name) >= sizeof(r.name) || node->AccountNumber < FIRST_ACCOUNT_NUMBER) {
+        return 0;
+    }
+    if (slot >= coldSlotCapacity) {
+        uint32_t capacity = coldSlotCapacity ? coldSlotCapacity : 1024;
+        while (capacity <= slot) {
+            capacity *= 2;
+        }
+        uint32_t *slots = (uint32_t *)realloc(coldSlots, capacity * sizeof(uint32_t));
+        if (slots == NULL) {
+            return 0;
+        }
+        memset(slots + coldSlotCapacity, 0, (capacity - coldSlotCapacity) * sizeof(uint32_t));
+        coldSlots = slots;
+        coldSlotCapacity = capacity;
+    }
+    r.accountNumber = node->AccountNumber;
+    r.accountType = (int32_t)node->accountType;
+    r.amount = node->Amount;
+    memcpy(r.name, node->Name, strlen(node->Name) + 1);
+    if (coldFreeCount > 0) {
+        uint32_t record = coldFreeRecords[--coldFreeCount];
+        if (pwrite(coldFd, &r, sizeof(r), (off_t)record * (off_t)sizeof(r)) != (ssize_t)sizeof(r)) {
+            coldFreeCount++;
+            return 0;
+        }
+        coldSlots[slot] = record + 1;
+        return 1;
+    }
+    if (w->fill == 0) {
+        w->first = coldRecordCount;
+    }
+    w->page[w->fill++] = r;
+    coldRecordCount++;
+    if (coldRecordCount % COLD_RECORDS_PER_PAGE == 0) {
+        coldWriterFlush(w); // The page is complete
+    }
+    return 1;
+}
+
+// Takes an account that was written to the cold store out of the index and the ordered
+// store, and frees its node. Its cold record keeps the name interned.
+void coldDetach(AccountNode *node) {
+    storeUnlink(node);
+    nameIntern(node->Name);
+    retireAccountNode(node);
+}
+
+// Evicts every resident account that has been idle for longer than coldAfter seconds.
+// Returns the number of accounts evicted. Call with bankLock held.
+long long coldSweep(void) {
+    if (coldFd < 0) {
+        return 0;
+    }
+    time_t now = time(NULL);
+    coldLastSweep = now;
+    ColdWriter *w = (ColdWriter *)malloc(sizeof(ColdWriter));
+    if (w == NULL) {
+        perror("Failed to allocate memory for eviction");
+        return 0;
+    }
+    w->fill = 0;
+
+    // Write the idle accounts out first; they stay resident until they are on disk
+    for (uint32_t slot = 0; slot < packedHighWater; slot++) {
+        int accountNumber = (int)slot + FIRST_ACCOUNT_NUMBER;
+        uint32_t lastChange = activityOf(accountNumber); // 0 if unknown, which is never idle
+        AccountNode *node;
+        if (packedLive(&packedTable[slot]) && lastChange != 0 && (uint32_t)now - lastChange > coldAfter &&
+            (node = findAccountByNumber(accountNumber)) != NULL) {
+            coldWrite(w, node);
+        }
+    }
+    coldWriterFlush(w);
+    free(w);
+
+    // Then unlink the accounts that made it to disk
+    long long evicted = 0;
+    if (accountStore == STORE_LIST) {
+        AccountNode *prev = NULL;
+        for (AccountNode **link = &accountsHead; *link != NULL;) {
+            AccountNode *node = *link;
+            if (coldRecordOf(node->AccountNumber) == 0) {
+                prev = node;
+                link = &node->next;
+                continue;
+            }
+            *link = node->next;
+            if (node == orderedTail) {
+                orderedTail = prev; // The ordered prefix now ends one node earlier
+            }
+            coldDetach(node);
+            evicted++;
+        }
+    } else {
+        for (uint32_t slot = 0; slot < coldSlotCapacity && slot < packedHighWater; slot++) {
+            AccountNode *node;
+            if (coldSlots[slot] != 0 && (node = findAccountByNumber((int)slot + FIRST_ACCOUNT_NUMBER)) != NULL) {
+                coldDetach(node);
+                evicted++;
+            }
+        }
+    }
+    bankStats.coldAccounts += evicted;
+    bankStats.coldEvictions += evicted;
+    return evicted;
+}
+
+// Runs a sweep if the last one was long enough ago. Takes bankLock.
+void coldMaybeSweep(void) {
+    if (coldFd < 0 || time(NULL) - coldLastSweep < COLD_SWEEP_INTERVAL) {
+        return;
+    }
+    pthread_mutex_lock(&bankLock);
+    coldSweep();
+    pthread_mutex_unlock(&bankLock);
+}
+
+// Brings an evicted account back into the book and returns it, or NULL if it is not
+// evicted or cannot be read. Call with bankLock held.
+AccountNode *coldFault(int accountNumber) {
+    AccountNode *node = (AccountNode *)poolAlloc(&accountPool);
+    if (node == NULL) {
+        perror("Failed to allocate memory for account node");
+        return NULL;
+    }
+    memset(node, 0, sizeof(AccountNode));
+    if (!coldPeek(accountNumber, node)) {
+        poolFree(&accountPool, node);
+        return NULL;
+    }
+    // The node takes over the cold record's reference to the name
+    if (storeLink(node) != 0) {
+        poolFree(&accountPool, node); // Stays evicted
+        return NULL;
+    }
+    if (accountStore == STORE_LIST) {
+        // Join the unordered part of the list, which starts after orderedTail
+        AccountNode *after = orderedTail != NULL ? orderedTail : accountsHead;
+        if (after == NULL) {
+            accountsHead = node;
+        } else {
+            node->next = after->next;
+            after->next = node;
+        }
+    }
+    uint32_t slot = (uint32_t)(accountNumber - FIRST_ACCOUNT_NUMBER);
+    uint32_t record = coldSlots[slot] - 1;
+    coldSlots[slot] = 0;
+    if (coldFreeCount == coldFreeCapacity) {
+        uint32_t capacity = coldFreeCapacity ? coldFreeCapacity * 2 : 1024;
+        uint32_t *records = (uint32_t *)realloc(coldFreeRecords, capacity * sizeof(uint32_t));
+        if (records != NULL) {
+            coldFreeRecords = records;
+            coldFreeCapacity = capacity;
+        }
+    }
+    if (coldFreeCount < coldFreeCapacity) {
+        coldFreeRecords[coldFreeCount++] = record; // Otherwise the record is just never reused
+    }
+    bankStats.coldAccounts--;
+    bankStats.coldFaults++;
+    return node;
+}
+
+// Returns the account with the given number, faulting it back in if it was evicted, or
+// NULL if there is no such account. Call with bankLock held.
+AccountNode *accountFind(int accountNumber) {
+    AccountNode *node = storeFind(accountNumber);
+    if (node == NULL && coldRecordOf(accountNumber) != 0) {
+        node = coldFault(accountNumber);
+    }
+    return node;
+}
+
+// Reads the balance of an account under bankLock, from the cold store if it is evicted.
+// Returns 1 and stores the balance in *amount, or 0 if there is no such account.
+int lockedBalance(int accountNumber, float *amount) {
+    pthread_mutex_lock(&bankLock);
+    AccountNode copy;
+    AccountNode *node = findAccountByNumber(accountNumber);
+    if (node == NULL && coldPeek(accountNumber, &copy)) {
+        node = &copy;
+    }
+    if (node != NULL) {
+        *amount = node->Amount;
+    }
+    pthread_mutex_unlock(&bankLock);
+    return node != NULL;
+}
+
+// Opens the cold store file. Returns 0 on success, -1 on failure.
+int coldOpen(const char *path) {
+    coldFd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (coldFd < 0) {
+        perror("Failed to open cold store");
+        return -1;
+    }
+    coldLastSweep = time(NULL);
+    return 0;
+}
+
+// Closes the cold store and forgets every record.
+void coldClose(void) {
+    if (coldFd >= 0) {
+        close(coldFd);
+    }
+    coldFd = -1;
+    free(coldSlots);
+    free(coldFreeRecords);
+    coldSlots = coldFreeRecords = NULL;
+    coldSlotCapacity = coldRecordCount = coldFreeCount = coldFreeCapacity = 0;
+    bankStats.coldAccounts = 0;
+    free(coldScratch.displayRow); // The main thread's copy; other threads free theirs on exit
+    coldScratch.displayRow = NULL;
+}
+
+// Report rows.
+// DISPLAY and LOWBALANCE lines are formatted once per account and cached in the node until
+// its name, type or balance changes, so a report is mostly a copy of cached rows into one
+// output buffer. LOWBALANCE uses the same row without its account type column.
+_Thread_local char *reportBuffer = NULL;   // Output buffer of the current report
+_Thread_local size_t reportBufferCapacity = 0;
+
+// Returns the DISPLAY line of an account, formatting it only if the cached one is stale.
+// Returns NULL if memory for the row could not be allocated.
+const char *accountDisplayRow(AccountNode *node) {
+    if (node->displayRowValid) {
+        bankStats.rowCacheHits++;
+        return node->displayRow;
+    }
+    bankStats.rowCacheMisses++;
+    char line[256];
+    int typeStart = snprintf(line, sizeof(line), "%d\t\t\t", node->AccountNumber);
+    int typeEnd = typeStart + snprintf(line + typeStart, sizeof(line) - typeStart, "%s\t\t\t", accountPolicies[node->accountType].name);
+    int length = typeEnd + snprintf(line + typeEnd, sizeof(line) - typeEnd, "%-50s\t\t%10.2f\n", node->Name, node->Amount);
+    if (length >= (int)sizeof(line)) {
+        length = sizeof(line) - 1;
+    }
+    char *row = (char *)realloc(node->displayRow, (size_t)length + 1);
+    if (!row) {
+        perror("Failed to allocate memory for report row");
+        return NULL;
+    }
+    memcpy(row, line, (size_t)length + 1);
+    node->displayRow = row;
+    node->displayRowLength = (unsigned short)length;
+    node->displayRowTypeStart = (unsigned char)typeStart;
+    node->displayRowTypeEnd = (unsigned char)typeEnd;
+    node->displayRowValid = 1;
+    return row;
+}
+
+// Makes sure the report buffer can hold 'size' bytes. Returns 1 on success, 0 on failure.
+int reserveReportBuffer(size_t size) {
+    if (size <= reportBufferCapacity) {
+        return 1;
+    }
+    size_t capacity = reportBufferCapacity ? reportBufferCapacity : 4096;
+    while (capacity < size) {
+        capacity *= 2;
+    }
+    char *grown = (char *)realloc(reportBuffer, capacity);
+    if (!grown) {
+        perror("Failed to allocate memory for report");
+        return 0;
+    }
+    reportBuffer = grown;
+    reportBufferCapacity = capacity;
+    return 1;
+}
+
+// Releases this thread's report buffer.
+void reportBufferFree(void) {
+    free(reportBuffer);
+    reportBuffer = NULL;
+    reportBufferCapacity = 0;
+}
+
+// Displays the accounts of a walk in the order the cursor produces them.
+// If there are none, it prints a message indicating so.
+void displayAccounts(AccountCursor *cursor) {
+    AccountNode *node = cursorNext(cursor);
+    if (node == NULL) {
+        fprintf(bankOut, "No Accounts to display\n");
+        return;
+    }
+
+    fprintf(bankOut, "Account Number\t\tAccount Type\t\tName                                              \t\t  Balance\n");
+    fprintf(bankOut, "--------------------------------------------------------------------------------------------------------------------------\n");
+
+    // Gather the cached row of each account, then write them at once
+    size_t used = 0;
+    for (; node != NULL; node = cursorNext(cursor)) {
+        if (accountDisplayRow(node) == NULL || !reserveReportBuffer(used + node->displayRowLength)) {
+            break;
+        }
+        memcpy(reportBuffer + used, node->displayRow, node->displayRowLength);
+        used += node->displayRowLength;
+    }
+    fwrite(reportBuffer, 1, used, bankOut);
+    fprintf(bankOut, "--------------------------------------------------------------------------------------------------------------------------\n");
+}
+
+// Displays all accounts in the provided list.
+// If the list is empty, it prints a message indicating so.
+void display(AccountList l) {
+    AccountCursor cursor = listCursor(l);
+    displayAccounts(&cursor);
+}
+
+// Adds a deleted account number to the list of recyclable numbers.
+// Allocates a new node for the number and appends it to the end of the list.
+DeletedAccountNumList addDeletedAccountNum(DeletedAccountNumList list, int accountNumToAdd) {
+    DeletedAccountNumNode *new_node = (DeletedAccountNumNode *)malloc(sizeof(DeletedAccountNumNode));
+    if (!new_node) {
+        perror("Failed to allocate memory for new deleted account number node");
+        return list; // Return original list on allocation failure
+    }
+    new_node->AccountNum = accountNumToAdd;
+    new_node->next = NULL;
+
+    // If the list is empty, the new node becomes the head
+    if (list == NULL) {
+        return new_node;
+    }
+
+    // Traverse to the end of the list and append the new node
+    DeletedAccountNumNode *current = list;
+    while (current->next != NULL) {
+        current = current->next;
+    }
+    current->next = new_node;
+    return list;
+}
+
+// Sorts the list of deleted account numbers in ascending order.
+// Uses a selection sort algorithm. This helps in reusing the smallest available account number first.
+DeletedAccountNumList sortDeletedAccountNumList(DeletedAccountNumList list) {
+    if (list == NULL || list->next == NULL) {
+        return list; // Already sorted or empty, no need to sort
+    }
+    DeletedAccountNumNode *current = list;
+    while (current != NULL) {
+        DeletedAccountNumNode *minNode = current;
+        DeletedAccountNumNode *runner = current->next;
+        // Find the node with the minimum account number in the rest of the list
+        while (runner != NULL) {
+            if (runner->AccountNum < minNode->AccountNum) {
+                minNode = runner;
+            }
+            runner = runner->next;
+        }
+        // Swap the account numbers if a smaller one is found
+        if (minNode != current) {
+            int temp = current->AccountNum;
+            current->AccountNum = minNode->AccountNum;
+            minNode->AccountNum = temp;
+        }
+        current = current->next;
+    }
+    return list;
+}
+
+// Creates a new bank account and adds it to the account list.
+// It reuses an account number from the deleted list if available, otherwise generates a new one.
+AccountList createAccount(DeletedAccountNumList *deletedNumsListHead, AccountList list, AccountType accountType, const char *Name, float Amount) {
+    if (*deletedNumsListHead == NULL && globalNextAccountNumber > MAX_ACCOUNT_NUMBER) {
+        fprintf(bankOut, "Invalid: All account numbers up to %d are in use\n", MAX_ACCOUNT_NUMBER);
+        return list;
+    }
+    AccountNode *new_node = (AccountNode *)poolAlloc(&accountPool);
+    if (!new_node) {
+        perror("Failed to allocate memory for new account node");
+        return list; // Return original list on allocation failure
+    }
+    new_node->accountType = accountType;
+    new_node->Name = nameIntern(Name); // Shared with the customer's other account, if any
+    if (!new_node->Name) {
+        perror("Failed to allocate memory for account name");
+        poolFree(&accountPool, new_node); // Free the allocated AccountNode
+        return list;    // Return original list on allocation failure
+    }
+    new_node->Amount = Amount;
+
+    // Assign account number:
+    // 1. Try to recycle from the sorted list of deleted account numbers.
+    // 2. If no recycled numbers, generate a new one using globalNextAccountNumber.
+    int recycled = *deletedNumsListHead != NULL;
+    if (recycled) {
+        new_node->AccountNumber = (*deletedNumsListHead)->AccountNum;
+        DeletedAccountNumNode *temp = *deletedNumsListHead;
+        *deletedNumsListHead = (*deletedNumsListHead)->next; // Remove the used number from the list
+        free(temp); // Free the node of the recycled number
+    } else {
+        new_node->AccountNumber = globalNextAccountNumber++; // Use global counter and increment
+    }
+
+    new_node->next = NULL;
+    if (accountCreated(new_node) != 0) {
+        perror("Failed to allocate memory for new account");
+        if (recycled) { // Give the number back
+            *deletedNumsListHead = addDeletedAccountNum(*deletedNumsListHead, new_node->AccountNumber);
+        } else {
+            globalNextAccountNumber--;
+        }
+        nameRelease(new_node->Name);
+        poolFree(&accountPool, new_node);
+        return list;
+    }
+
+    fprintf(bankOut, "Account Created Successfully\n");
+    fprintf(bankOut, "Account Number: %d\n", new_node->AccountNumber);
+    fprintf(bankOut, "Account Holder: %s\n", new_node->Name);
+    fprintf(bankOut, "Account Type: %s\n", accountPolicies[accountType].name);
+    fprintf(bankOut, "Balance: Rs %.2f\n\n", new_node->Amount);
+
+    // Ordered stores took the account in accountCreated(); only the list needs linking
+    if (accountStore != STORE_LIST) {
+        return list;
+    }
+
+    // If the account list is empty, the new node becomes the head
+    if (list == NULL) {
+        return new_node;
+    }
+
+    // Traverse to the end of the account list and append the new node
+    AccountNode *current = list;
+    while (current->next != NULL) {
+        current = current->next;
+    }
+    current->next = new_node;
+    return list;
+}
+
+// Deletes an account from the list based on account holder's name and account type.
+// The account number of the deleted account is returned via the deletedAccountNumber pointer.
+AccountList deleteAccount(AccountList list, AccountType accountType, const char *Name, int *deletedAccountNumber) {
+    AccountNode *current = list;
+    AccountNode *prev = NULL;
+    *deletedAccountNumber = -1; // Initialize to -1 (indicates account not found/deleted)
+
+    if (bankStats.accounts == 0) {
+        fprintf(bankOut, "No Accounts to delete\n");
+        return list;
+    }
+
+    // The interned name knows the number of the account; an evicted one is faulted back in.
+    // The list is then walked for the predecessor only.
+    int accountNumber = nameAccount(Name, accountType);
+    current = accountNumber != 0 ? accountFind(accountNumber) : NULL;
+    if (current != NULL && accountStore == STORE_LIST) {
+        list = accountsHead; // Faulting in an account may have started the list
+        for (AccountNode *node = list; node != current; node = node->next) {
+            prev = node;
+        }
+    }
+    if (current == NULL) {
+        fprintf(bankOut, "Invalid: Account '%s' of type %s does not exist for deletion\n", Name, accountPolicies[accountType].name);
+        return list; // Return original list if not found
+    }
+
+    *deletedAccountNumber = current->AccountNumber; // Capture the account number
+    accountDeleted(current); // Also removes it from an ordered store
+    if (accountStore == STORE_LIST) {
+        if (current == orderedTail) {
+            orderedTail = prev; // The ordered prefix now ends one node earlier
+        }
+        if (prev == NULL) { // Account to delete is the head node
+            list = current->next;
+        } else { // Account to delete is in the middle or at the end
+            prev->next = current->next;
+        }
+    }
+    retireAccountNode(current); // Freed once no lock-free reader can still hold it
+    fprintf(bankOut, "Account deleted successfully! Account Number: %d\n", *deletedAccountNumber);
+    return list; // Return the modified list
+}
+
+// Describes the low-balance test in report headers: "less than Rs 100.00" while all types
+// share one limit, otherwise a reference to the limit of each account's type.
+void lowBalanceLimitText(char *text, size_t size) {
+    for (int type = 1; type < ACCOUNT_TYPE_COUNT; type++) {
+        if (accountPolicies[type].lowBalance != accountPolicies[0].lowBalance) {
+            snprintf(text, size, "below the low-balance limit of its type");
+            return;
+        }
+    }
+    snprintf(text, size, "less than Rs %.2f", accountPolicies[0].lowBalance);
+}
+
+// Displays the accounts of a walk whose balance is below the low-balance limit of their type.
+void lowBalanceAccountsIn(AccountCursor *cursor) {
+    AccountNode *l = cursorNext(cursor);
+    // A low balance scan also comes back empty when the book has no low balances
+    if (l == NULL && (!cursor->packedScan || bankStats.accounts == 0)) {
+        fprintf(bankOut, "No Accounts to display\n");
+        return;
+    }
+    int foundLowBalance = 0; // Flag to check if any low balance account is found
+    char limit[64];
+    lowBalanceLimitText(limit, sizeof(limit));
+    fprintf(bankOut, "Accounts with balance %s:\n", limit);
+    fprintf(bankOut, "Account Number\t\tName                                              \t\t     Balance\n");
+    fprintf(bankOut, "----------------------------------------------------------------------------------------------------\n");
+
+    // Traverse the list and gather the cached rows of low balance accounts, minus the type column
+    size_t used = 0;
+    while (l != NULL) {
+        if (l->Amount < accountPolicies[l->accountType].lowBalance) {
+            if (accountDisplayRow(l) == NULL || !reserveReportBuffer(used + l->displayRowLength)) {
+                break;
+            }
+            memcpy(reportBuffer + used, l->displayRow, l->displayRowTypeStart);
+            used += l->displayRowTypeStart;
+            memcpy(reportBuffer + used, l->displayRow + l->displayRowTypeEnd, l->displayRowLength - l->displayRowTypeEnd);
+            used += l->displayRowLength - l->displayRowTypeEnd;
+            foundLowBalance = 1;
+        }
+        l = cursorNext(cursor);
+    }
+    fwrite(reportBuffer, 1, used, bankOut);
+    if (!foundLowBalance) {
+        fprintf(bankOut, "No accounts found with balance %s\n", limit);
+    }
+    fprintf(bankOut, "----------------------------------------------------------------------------------------------------\n");
+}
+
+// Displays the accounts whose balance is below the low-balance limit of their type.
+void lowBalanceAccounts(AccountList l) {
+    AccountCursor cursor = listCursor(l);
+    lowBalanceAccountsIn(&cursor);
+}
+
+// Outcome of applying a transaction to an account.
+typedef enum TransactionResult {
+    TRANSACTION_OK,             // Balance updated
+    TRANSACTION_BELOW_MINIMUM,  // Withdrawal would leave the account below its type's minimum balance
+    TRANSACTION_OVERDRAWN,      // Withdrawal would take the account past its overdraft limit
+    TRANSACTION_INVALID_CODE,   // Code is neither 1 (deposit) nor 0 (withdrawal)
+    TRANSACTION_NO_ACCOUNT      // No account with that number
+} TransactionResult;
+
+// Applies a deposit ('code = 1') or withdrawal ('code = 0') to an account.
+// Checks the balance rules of the account's type but neither prints nor sends change
+// notifications. A withdrawal also takes the type's fee.
+TransactionResult applyTransaction(AccountNode *node, float amount, int code) {
+    if (code == 1) { // Deposit
+        AccountStripe *stripe = accountStripe(node->AccountNumber);
+        stripeWriteBegin(stripe);
+        node->Amount += amount;
+        stripeWriteEnd(stripe);
+        return TRANSACTION_OK;
+    }
+    if (code != 0) {
+        return TRANSACTION_INVALID_CODE;
+    }
+    // One check for every type: the balance left must not fall below the type's floor
+    const AccountPolicy *policy = &accountPolicies[node->accountType];
+    if (node->Amount - amount - policy->withdrawalFee < policy->withdrawalFloor) {
+        return policy->withdrawalFloor > 0 ? TRANSACTION_BELOW_MINIMUM : TRANSACTION_OVERDRAWN;
+    }
+    AccountStripe *stripe = accountStripe(node->AccountNumber);
+    stripeWriteBegin(stripe);
+    node->Amount -= amount + policy->withdrawalFee;
+    stripeWriteEnd(stripe);
+    return TRANSACTION_OK;
+}
+
+// Performs a transaction (deposit or withdrawal) on a specified account.
+// 'code = 1' for deposit, 'code = 0' for withdrawal.
+AccountList transaction(AccountList list, int transactionAccountNumber, float amount, int code) {
+    if (bankStats.accounts == 0) {
+        fprintf(bankOut, "No Accounts to display for transactions\n");
+        return list;
+    }
+
+    // Look the account up in the selected store, faulting it back in if it was evicted
+    AccountNode *current = accountFind(transactionAccountNumber);
+    if (list == NULL) {
+        list = accountsHead; // Faulting in an account may have started the list
+    }
+    if (current == NULL) {
+        fprintf(bankOut, "Invalid: Account with number %d does not exist for transaction\n", transactionAccountNumber);
+        return list;
+    }
+
+    float oldAmount = current->Amount;
+    switch (applyTransaction(current, amount, code)) {
+    case TRANSACTION_OK:
+        balanceChanged(current, oldAmount);
+        if (code == 1) {
+            fprintf(bankOut, "Deposit successful. Updated balance for account %d is Rs.%.2f\n", transactionAccountNumber, current->Amount);
+        } else {
+            fprintf(bankOut, "Withdrawal successful. Updated balance for account %d is Rs.%.2f\n", transactionAccountNumber, current->Amount);
+        }
+        break;
+    case TRANSACTION_BELOW_MINIMUM:
+        fprintf(bankOut, "The balance is insufficient for the specified withdrawal (Minimum Rs %.2f required for %s)\n",
+                accountPolicies[current->accountType].minimumBalance, accountPolicies[current->accountType].label);
+        break;
+    case TRANSACTION_OVERDRAWN:
+        if (accountPolicies[current->accountType].overdraftLimit > 0) {
+            fprintf(bankOut, "The balance is insufficient for the specified withdrawal (Overdraft limit Rs %.2f)\n",
+                    accountPolicies[current->accountType].overdraftLimit);
+        } else {
+            fprintf(bankOut, "The balance is insufficient for the specified withdrawal (Cannot overdraw)\n");
+        }
+        break;
+    default:
+        fprintf(bankOut, "Invalid Transaction Code (1 for deposit, 0 for withdrawal)\n");
+        break;
+    }
+    return list;
+}
+
+// Reads the balance of an account without taking any lock.
+// The read is optimistic: it is retried if a writer updated or deleted an account of the
+// same stripe meanwhile. Readers only load shared memory, so they never slow down each
+// other. The node it looks at stays allocated until the read ends (see epochEnter()).
+// Returns 1 and stores the balance in *amount, or 0 if there is no such account.
+int readBalance(int accountNumber, float *amount) {
+    if (!epochEnter()) {
+        return lockedBalance(accountNumber, amount); // No reader slot left: read under the lock instead
+    }
+    AccountStripe *stripe = accountStripe(accountNumber);
+    while (1) {
+        uint32_t version = __atomic_load_n(&stripe->version, __ATOMIC_ACQUIRE);
+        if (version & 1) {
+            sched_yield(); // A writer is in the middle of an update
+            continue;
+        }
+        AccountNode *node = findAccountByNumber(accountNumber);
+        float value = 0;
+        if (node != NULL) {
+            __atomic_load(&node->Amount, &value, __ATOMIC_RELAXED);
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&stripe->version, __ATOMIC_RELAXED) == version) {
+            epochExit();
+            if (node == NULL && coldFd >= 0) {
+                return lockedBalance(accountNumber, amount); // May have been evicted
+            }
+            *amount = value;
+            return node != NULL;
+        }
+    }
+}
+
+// One transaction of a batch.
+typedef struct TransactionRequest {
+    int accountNumber;          // Account to post to
+    float amount;               // Amount of the deposit or withdrawal
+    int code;                   // 1 for deposit, 0 for withdrawal
+    long long tag;              // Caller's reference (for example a line number); orders requests of one account
+    TransactionResult result;   // Filled in by applyTransactionBatch()
+    AccountType accountType;    // Filled in by applyTransactionBatch() if the account exists
+} TransactionRequest;
+
+// Compares two batch requests by account number, then by tag.
+int compareTransactionRequests(const void *a, const void *b) {
+    const TransactionRequest *x = (const TransactionRequest *)a;
+    const TransactionRequest *y = (const TransactionRequest *)b;
+    if (x->accountNumber != y->accountNumber) {
+        return x->accountNumber < y->accountNumber ? -1 : 1;
+    }
+    return (x->tag > y->tag) - (x->tag < y->tag);
+}
+
+// Applies a batch of transactions without printing anything.
+// 'requests' must be grouped by account (see compareTransactionRequests()); within an
+// account they are applied in order. Each account is looked up once and gets a single
+// change notification for its final balance, however many requests it had.
+// Returns the number of requests applied successfully.
+size_t applyTransactionBatch(TransactionRequest *requests, size_t count) {
+    size_t applied = 0;
+    size_t i = 0;
+    while (i < count) {
+        int accountNumber = requests[i].accountNumber;
+        AccountNode *node = accountFind(accountNumber);
+        float oldAmount = node != NULL ? node->Amount : 0;
+        size_t groupApplied = 0;
+        for (; i < count && requests[i].accountNumber == accountNumber; i++) {
+            if (node == NULL) {
+                requests[i].result = TRANSACTION_NO_ACCOUNT;
+                continue;
+            }
+            requests[i].accountType = node->accountType;
+            requests[i].result = applyTransaction(node, requests[i].amount, requests[i].code);
+            if (requests[i].result == TRANSACTION_OK) {
+                groupApplied++;
+            }
+        }
+        if (groupApplied > 0) {
+            balanceChanged(node, oldAmount);
+            applied += groupApplied;
+        }
+    }
+    return applied;
+}
+
+// Returns a short description of a transaction result on an account of type 'type'.
+const char *transactionResultText(TransactionResult result, AccountType type) {
+    switch (result) {
+    case TRANSACTION_OK:
+        return "ok";
+    case TRANSACTION_BELOW_MINIMUM:
+        return accountPolicies[type].belowMinimumText;
+    case TRANSACTION_OVERDRAWN:
+        return accountPolicies[type].overdrawnText;
+    case TRANSACTION_INVALID_CODE:
+        return "invalid transaction code";
+    default:
+        return "no such account";
+    }
+}
+
+// Credits every account with interest at its type's annual rate on its average balance since
+// its last accrual, and starts a new period for it. The interest comes from the balance
+// integrals alone and is posted as one batch of deposits; evicted accounts that earn interest
+// are faulted back in. The run is logged, so recovery restarts the periods at the same point.
+// Call with the book locked.
+void accrueInterest(void) {
+    uint32_t now = changeTime();
+    uint32_t slots = balanceIntegralCapacity < packedHighWater ? balanceIntegralCapacity : packedHighWater;
+    TransactionRequest *requests = (TransactionRequest *)malloc((slots ? slots : 1) * sizeof(TransactionRequest));
+    if (requests == NULL) {
+        perror("Failed to allocate memory for interest postings");
+        return;
+    }
+    size_t count = 0;
+    long long totalPaise = 0;
+    for (uint32_t slot = 0; slot < slots; slot++) {
+        BalanceIntegral *integral = interestBearing(slot);
+        if (integral == NULL) {
+            continue;
+        }
+        AccountType type = packedType(&packedTable[slot]);
+        double years = (double)(now - integral->periodStart) / SECONDS_PER_YEAR;
+        long long interest = (long long)(averageBalance(integral, now) * accountPolicies[type].annualInterest / 100.0 * years + 0.5);
+        if (interest > 0) {
+            // Slots are visited in account number order, so the batch is already grouped
+            requests[count++] = (TransactionRequest){(int)(slot + FIRST_ACCOUNT_NUMBER), interest / 100.0f, 1, slot, TRANSACTION_OK, type};
+            totalPaise += interest;
+        }
+    }
+    restartAccrualPeriods(now);
+    walLogAccrual(); // Before the deposits, so that replay restarts the periods first
+    size_t applied = applyTransactionBatch(requests, count);
+    free(requests);
+    fprintf(bankOut, "Accrued Rs %.2f interest on %zu account(s)\n", totalPaise / 100.0, applied);
+}
+
+// Grants a loan of 'amount' at 'annualRate' percent a year over 'months' months, linked to a
+// current account, and credits the amount to that account. The EMI is the level installment
+// that repays the loan in that many months at the fixed-point monthly rate, rounded up to a
+// paisa. Call with the book locked.
+void createLoan(int accountNumber, float amount, double annualRate, int months) {
+    PackedAccount *record = packedRecord(accountNumber);
+    if (record == NULL || packedType(record) != CURRENT) {
+        fprintf(bankOut, "Invalid: Loans can only be linked to an existing current account\n");
+        return;
+    }
+    if (!(amount > 0 && amount <= LOAN_MAX_PRINCIPAL) || !(annualRate >= 0 && annualRate <= 100) ||
+        months < 1 || months > LOAN_MAX_MONTHS) {
+        fprintf(bankOut, "Invalid loan terms (amount up to Rs %.0f, rate 0 to 100%%, 1 to %d months)\n",
+                LOAN_MAX_PRINCIPAL, LOAN_MAX_MONTHS);
+        return;
+    }
+    int64_t principal = toPaise(amount);
+    int64_t monthlyRate = (int64_t)(annualRate / 1200.0 * (1 << LOAN_RATE_BITS) + 0.5);
+    double rate = (double)monthlyRate / (1 << LOAN_RATE_BITS);
+    double growth = 1;
+    for (int m = 0; m < months; m++) {
+        growth *= 1 + rate;
+    }
+    double level = monthlyRate > 0 ? principal * rate * growth / (growth - 1) : (double)principal / months;
+    int64_t emi = (int64_t)level;
+    emi += emi < level;
+    long long loan = loanAdd(accountNumber, principal, monthlyRate, emi);
+    if (loan < 0) {
+        return;
+    }
+    walLogLoan(accountNumber, principal, monthlyRate, emi);
+    TransactionRequest disbursal = {accountNumber, amount, 1, loan, TRANSACTION_OK, CURRENT};
+    applyTransactionBatch(&disbursal, 1);
+    fprintf(bankOut, "Loan %lld of Rs %.2f credited to account %d: EMI Rs %.2f for %d month(s)\n",
+            loan + 1, principal / 100.0, accountNumber, emi / 100.0, months);
+}
+
+// Month-end run: works out every loan's installment with loanScheduleMonth() and debits them
+// from the linked accounts as one batch. A loan is only paid down by installments that went
+// through; one whose account cannot cover it stays as it was and counts as missed.
+// Call with the book locked.
+void postInstallments(void) {
+    LoanBook *book = &loanBook;
+    loanScheduleMonth(book);
+    TransactionRequest *requests = (TransactionRequest *)malloc((book->count ? book->count : 1) * sizeof(TransactionRequest));
+    if (requests == NULL) {
+        perror("Failed to allocate memory for loan installments");
+        return;
+    }
+    size_t count = 0;
+    for (size_t i = 0; i < book->count; i++) {
+        if (book->account[i] != 0 && book->due[i] > 0) {
+            requests[count++] = (TransactionRequest){book->account[i], book->due[i] / 100.0f, 0, (long long)i, TRANSACTION_OK, CURRENT};
+        }
+    }
+    qsort(requests, count, sizeof(TransactionRequest), compareTransactionRequests);
+    applyTransactionBatch(requests, count);
+    size_t paid = 0, settled = 0;
+    int64_t collected = 0, interest = 0;
+    for (size_t r = 0; r < count; r++) {
+        size_t i = (size_t)requests[r].tag;
+        if (requests[r].result != TRANSACTION_OK) {
+            continue;
+        }
+        book->principal[i] -= book->due[i] - book->interest[i];
+        walLogInstallment((long long)i, book->principal[i]);
+        collected += book->due[i];
+        interest += book->interest[i];
+        paid++;
+        if (book->principal[i] == 0) {
+            book->account[i] = 0;
+            settled++;
+        }
+    }
+    free(requests);
+    int64_t outstanding;
+    size_t open = loansOutstanding(&outstanding);
+    fprintf(bankOut, "Debited %zu installment(s) of Rs %.2f (Rs %.2f interest); %zu missed, %zu loan(s) settled\n",
+            paid, collected / 100.0, interest / 100.0, count - paid, settled);
+    fprintf(bankOut, "%zu loan(s) outstanding: Rs %.2f principal\n", open, outstanding / 100.0);
+}
+
+// Merges two lists that are each ordered by account number into one, relinking the nodes.
+// The last node of the result is stored in *last.
+AccountList mergeAccountLists(AccountList a, AccountList b, AccountNode **last) {
+    AccountNode head;
+    AccountNode *tail = &head;
+    while (a != NULL && b != NULL) {
+        if (b->AccountNumber < a->AccountNumber) {
+            tail->next = b;
+            b = b->next;
+        } else {
+            tail->next = a;
+            a = a->next;
+        }
+        tail = tail->next;
+    }
+    tail->next = a != NULL ? a : b;
+    while (tail->next != NULL) {
+        tail = tail->next;
+    }
+    *last = tail == &head ? NULL : tail;
+    return head.next;
+}
+
+// Sorts the account list by account number in ascending order.
+// Uses a bottom-up merge sort that relinks the nodes: every node keeps its account, so
+// pointers to nodes (such as the account number index) stay valid across sorts.
+AccountList sortAccountListByNumber(AccountList list) {
+    if (list == NULL || list->next == NULL) {
+        return list; // Already sorted or empty
+    }
+    // runs[i] holds an ordered run of 2^i nodes, or NULL. Each node taken from the list is
+    // carried up through the occupied slots by merging, like incrementing a binary counter.
+    AccountNode *runs[64] = {NULL};
+    AccountNode *last;
+    while (list != NULL) {
+        AccountNode *run = list;
+        list = list->next;
+        run->next = NULL;
+        int i = 0;
+        while (i < 63 && runs[i] != NULL) {
+            run = mergeAccountLists(runs[i], run, &last);
+            runs[i++] = NULL;
+        }
+        runs[i] = run;
+    }
+    // Merge the remaining runs, smallest first; earlier runs hold earlier nodes
+    AccountNode *sorted = NULL;
+    for (int i = 0; i < 64; i++) {
+        if (runs[i] != NULL) {
+            sorted = mergeAccountLists(runs[i], sorted, &last);
+        }
+    }
+    return sorted;
+}
+
+// Brings the account book into account number order before a report.
+// Returns at once if no account was created since the last call. Otherwise only the new
+// accounts are sorted, and then merged into the ordered prefix in a single pass.
+void orderAccounts(void) {
+    AccountNode *unordered = orderedTail != NULL ? orderedTail->next : accountsHead;
+    if (unordered == NULL) {
+        return; // Already in order
+    }
+    if (orderedTail != NULL) {
+        orderedTail->next = NULL;
+    } else {
+        accountsHead = NULL;
+    }
+    unordered = sortAccountListByNumber(unordered);
+    accountsHead = mergeAccountLists(accountsHead, unordered, &orderedTail);
+}
+
+// Returns a cursor over the whole book in account number order.
+// Only the account list needs sorting first; ordered stores are walked as they are.
+AccountCursor orderedAccounts(void) {
+    if (accountStore == STORE_LIST) {
+        orderAccounts();
+    }
+    return allAccounts();
+}
+
+// Returns a cursor over the whole book in account number order, evicted accounts included.
+AccountCursor bookAccounts(void) {
+    if (bankStats.coldAccounts > 0) {
+        return packedScan(0); // The stores only hold the resident accounts
+    }
+    return orderedAccounts();
+}
+
+// Arguments of one store benchmark thread.
+typedef struct StoreBenchThread {
+    AccountNode *accounts;      // Accounts of the benchmark
+    const int *order;           // Shuffled positions in 'accounts'
+    long long first;            // First position of this thread's share
+    long long step;             // Distance between the positions of this thread's share
+    long long count;            // Number of positions
+    int phase;                  // 0 insert, 1 look up, 2 walk in order, 3 delete
+    SkipNode **removed;         // Nodes this thread unlinked, freed after the benchmark
+    long long removedCount;
+} StoreBenchThread;
+
+// Runs one phase of the skip list benchmark on this thread's share of the accounts.
+void *storeBenchWorker(void *arg) {
+    StoreBenchThread *t = (StoreBenchThread *)arg;
+    for (long long i = t->first; i < t->count; i += t->step) {
+        AccountNode *account = &t->accounts[t->order[i]];
+        if (t->phase == 0) {
+            skipListInsert(&accountSkipList, account);
+        } else if (t->phase == 1) {
+            if (skipListFind(&accountSkipList, account->AccountNumber) != account) {
+                fprintf(stderr, "Skip list lost account %d\n", account->AccountNumber);
+            }
+        } else if (t->phase == 3) {
+            SkipNode *gone = skipListRemove(&accountSkipList, account->AccountNumber);
+            if (gone != NULL) {
+                t->removed[t->removedCount++] = gone;
+            }
+        }
+    }
+    if (t->phase == 2) {
+        // Every thread walks the whole book, as concurrent reports would
+        for (SkipNode *n = skipListNext(&accountSkipList, accountSkipList.head); n != NULL; n = skipListNext(&accountSkipList, n)) {
+            t->removedCount++;
+        }
+    }
+    return NULL;
+}
+
+// Prints the rate of 'operations' done in the time since 'start'.
+double benchRate(long long operations, long long start) {
+    double seconds = (monotonicNanos() - start) / 1e9;
+    return seconds > 0 ? operations / seconds / 1e6 : 0.0;
+}
+
+// Compares the account stores on 'count' accounts inserted, looked up and deleted in random
+// order, and walked in account number order. The skip list runs at 1, 2, 4, ... threads up
+// to twice the number of cores; the list and the B+-tree are guarded by the bank lock, so
+// they run on one.
+// Deleting from the list needs a walk to the predecessor, so only a sample is timed.
+int benchStore(long long count) {
+    if (count < 1 || count > INT_MAX - FIRST_ACCOUNT_NUMBER) {
+        fprintf(stderr, "Invalid number of accounts\n");
+        return 1;
+    }
+    AccountNode *accounts = (AccountNode *)calloc((size_t)count, sizeof(AccountNode));
+    int *order = (int *)malloc((size_t)count * sizeof(int));
+    if (!accounts || !order) {
+        perror("Failed to allocate memory for store benchmark");
+        free(accounts);
+        free(order);
+        return 1;
+    }
+    uint64_t seed = 0x2545f4914f6cdd1dULL;
+    for (long long i = 0; i < count; i++) {
+        accounts[i].AccountNumber = FIRST_ACCOUNT_NUMBER + (int)i;
+        order[i] = (int)i;
+    }
+    for (long long i = count - 1; i > 0; i--) {
+        seed = mix64(seed);
+        long long j = (long long)(seed % (uint64_t)(i + 1));
+        int swap = order[i];
+        order[i] = order[j];
+        order[j] = swap;
+    }
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int maxThreads = cores > 1 ? (int)cores * 2 : 2;
+    printf("Store benchmark: %lld accounts, %ld core(s); rates in million operations per second\n", count, cores);
+    printf("%-10s%-9s%-9s%-9s%-9s%s\n", "Store", "Threads", "Insert", "Lookup", "Scan", "Delete");
+
+    // Account list: append, index lookups, lazy sort before the first walk, delete by walking
+    AccountNode *head = NULL;
+    AccountNode **tail = &head;
+    long long start = monotonicNanos();
+    for (long long i = 0; i < count; i++) {
+        AccountNode *account = &accounts[order[i]];
+        account->next = NULL;
+        *tail = account;
+        tail = &account->next;
+        indexSet(account->AccountNumber, account);
+    }
+    double insertRate = benchRate(count, start);
+    start = monotonicNanos();
+    for (long long i = 0; i < count; i++) {
+        if (findAccountByNumber(accounts[order[i]].AccountNumber) == NULL) {
+            fprintf(stderr, "Index lost account %d\n", accounts[order[i]].AccountNumber);
+        }
+    }
+    double lookupRate = benchRate(count, start);
+    start = monotonicNanos();
+    head = sortAccountListByNumber(head);
+    long long walked = 0;
+    for (AccountNode *node = head; node != NULL; node = node->next) {
+        walked++;
+    }
+    double scanRate = benchRate(walked, start);
+    long long sample = count < 2000 ? count : 2000;
+    start = monotonicNanos();
+    for (long long i = 0; i < sample; i++) {
+        int accountNumber = accounts[order[i]].AccountNumber;
+        AccountNode **link = &head;
+        while (*link != NULL && (*link)->AccountNumber != accountNumber) {
+            link = &(*link)->next;
+        }
+        if (*link != NULL) {
+            indexSet(accountNumber, NULL);
+            *link = (*link)->next;
+        }
+    }
+    printf("%-10s%-9d%-9.3g%-9.3g%-9.3g%.3g\n", "list", 1, insertRate, lookupRate, scanRate, benchRate(sample, start));
+    indexFree();
+
+    // B+-tree: guarded by the bank lock like the list
+    start = monotonicNanos();
+    for (long long i = 0; i < count; i++) {
+        btreeInsert(&accountBTree, &accounts[order[i]]);
+    }
+    insertRate = benchRate(count, start);
+    start = monotonicNanos();
+    for (long long i = 0; i < count; i++) {
+        if (btreeFind(accountBTree, accounts[order[i]].AccountNumber) != &accounts[order[i]]) {
+            fprintf(stderr, "B+-tree lost account %d\n", accounts[order[i]].AccountNumber);
+        }
+    }
+    lookupRate = benchRate(count, start);
+    start = monotonicNanos();
+    walked = 0;
+    AccountCursor cursor = listCursor(NULL);
+    cursor.leaf = btreeFirstLeaf(accountBTree);
+    while (cursorNext(&cursor) != NULL) {
+        walked++;
+    }
+    scanRate = benchRate(walked, start);
+    start = monotonicNanos();
+    for (long long i = 0; i < count; i++) {
+        btreeRemove(accountBTree, accounts[order[i]].AccountNumber);
+    }
+    printf("%-10s%-9d%-9.3g%-9.3g%-9.3g%.3g\n", "btree", 1, insertRate, lookupRate, scanRate, benchRate(count, start));
+    btreeFree(accountBTree);
+    btreeSparesFree();
+    accountBTree = NULL;
+
+    // Skip list: every phase on all threads at once
+    for (int threads = 1; threads <= maxThreads; threads *= 2) {
+        if (!skipListInit(&accountSkipList)) {
+            free(accounts);
+            free(order);
+            return 1;
+        }
+        pthread_t tids[threads];
+        StoreBenchThread args[threads];
+        double rates[4];
+        for (int i = 0; i < threads; i++) {
+            args[i].accounts = accounts;
+            args[i].order = order;
+            args[i].first = i;
+            args[i].step = threads;
+            args[i].count = count;
+            args[i].removed = (SkipNode **)malloc(((size_t)count / threads + 1) * sizeof(SkipNode *));
+            args[i].removedCount = 0;
+        }
+        for (int phase = 0; phase < 4; phase++) {
+            start = monotonicNanos();
+            int started = 0;
+            for (int i = 0; i < threads; i++) {
+                args[i].phase = phase;
+                if (phase == 2) {
+                    args[i].removedCount = 0; // Counts the nodes walked
+                }
+                if ((phase == 3 && args[i].removed == NULL) || pthread_create(&tids[i], NULL, storeBenchWorker, &args[i]) != 0) {
+                    fprintf(stderr, "Failed to start benchmark thread\n");
+                    break;
+                }
+                started++;
+            }
+            for (int i = 0; i < started; i++) {
+                pthread_join(tids[i], NULL);
+            }
+            long long operations = count;
+            if (phase == 2) {
+                operations = 0;
+                for (int i = 0; i < started; i++) {
+                    operations += args[i].removedCount;
+                    args[i].removedCount = 0;
+                }
+            }
+            rates[phase] = benchRate(operations, start);
+        }
+        printf("%-10s%-9d%-9.3g%-9.3g%-9.3g%.3g\n", "skiplist", threads, rates[0], rates[1], rates[2], rates[3]);
+        for (int i = 0; i < threads; i++) {
+            for (long long j = 0; j < args[i].removedCount; j++) {
+                free(args[i].removed[j]);
+            }
+            free(args[i].removed);
+        }
+        skipListFree(&accountSkipList);
+    }
+    free(accounts);
+    free(order);
+    return 0;
+}
+
+// Opens a counter of this thread's data TLB read misses. Returns -1 if the kernel or the
+// hardware does not provide one.
+int perfOpenDtlbMisses(void) {
+#ifdef __linux__
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    return -1;
+#endif
+}
+
+// Measures random transaction-style lookups (index, then the account's balance) over
+// 'count' accounts whose nodes and index chunks live in arenas backed by ordinary pages,
+// THP-advised pages and explicit huge pages, with the data TLB misses of each run.
+int benchTlb(long long count) {
+    if (count < 1 || count > INT_MAX - FIRST_ACCOUNT_NUMBER) {
+        fprintf(stderr, "Invalid number of accounts\n");
+        return 1;
+    }
+    const PageMode modes[] = {PAGES_NORMAL, PAGES_THP, PAGES_EXPLICIT};
+    const char *labels[] = {"normal", "thp", "explicit"};
+    int perfFd = perfOpenDtlbMisses();
+    printf("TLB benchmark: %lld accounts, %lld random lookups per run\n", count, count);
+    if (perfFd < 0) {
+        printf("(data TLB miss counter unavailable: %s)\n", strerror(errno));
+    }
+    printf("%-10s%-16s%-14s%s\n", "Pages", "Huge+THP/all", "Mlookups/s", "dTLB misses/lookup");
+    for (int m = 0; m < 3; m++) {
+        pageMode = modes[m];
+        for (long long i = 0; i < count; i++) {
+            AccountNode *node = (AccountNode *)poolAlloc(&accountPool);
+            if (node == NULL) {
+                return 1;
+            }
+            memset(node, 0, sizeof(AccountNode));
+            node->AccountNumber = FIRST_ACCOUNT_NUMBER + (int)i;
+            node->Amount = (float)(i % 1000);
+            if (indexSet(node->AccountNumber, node) != 0) {
+                return 1;
+            }
+        }
+        uint64_t seed = 0x9e3779b97f4a7c15ULL;
+        float sum = 0;
+        if (perfFd >= 0) {
+            ioctl(perfFd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(perfFd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+        long long start = monotonicNanos();
+        for (long long i = 0; i < count; i++) {
+            seed = mix64(seed);
+            AccountNode *node = findAccountByNumber(FIRST_ACCOUNT_NUMBER + (int)(seed % (uint64_t)count));
+            sum += node->Amount;
+        }
+        double rate = benchRate(count, start);
+        long long misses = -1;
+        if (perfFd >= 0) {
+            ioctl(perfFd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(perfFd, &misses, sizeof(misses)) != (ssize_t)sizeof(misses)) {
+                misses = -1;
+            }
+        }
+        char huge[32];
+        snprintf(huge, sizeof(huge), "%zu+%zu/%zu", accountPool.hugeRegions + indexPool.hugeRegions,
+                 accountPool.adviseRegions + indexPool.adviseRegions, accountPool.regionCount + indexPool.regionCount);
+        if (misses >= 0) {
+            printf("%-10s%-16s%-14.3g%.3f\n", labels[m], huge, rate, (double)misses / count);
+        } else {
+            printf("%-10s%-16s%-14.3g%s\n", labels[m], huge, rate, "n/a");
+        }
+        if (sum < 0) {
+            printf("impossible\n"); // Keeps the lookups from being optimised away
+        }
+        indexFree();
+        poolRelease(&accountPool);
+        poolRelease(&indexPool);
+    }
+    if (perfFd >= 0) {
+        close(perfFd);
+    }
+    return 0;
+}
+
+
+
+// Frees every account and every recycled account number held by the book.
+void freeBank(void) {
+    AccountCursor cursor = allAccounts();
+    AccountNode *currentAcc;
+    while ((currentAcc = cursorNext(&cursor)) != NULL) {
+        freeAccountNode(currentAcc); // Free the name, the cached row and the node
+    }
+    accountsHead = NULL;
+    orderedTail = NULL;
+    epochFreeAll();
+    coldClose();
+    nameTableFree(); // Also frees the names evicted accounts held on to
+    storeClose();
+    DeletedAccountNumNode *currentDel = deletedAccountNumbersHead;
+    while (currentDel != NULL) {
+        DeletedAccountNumNode *nextDel = currentDel->next;
+        free(currentDel); // Free the deleted account number node
+        currentDel = nextDel;
+    }
+    deletedAccountNumbersHead = NULL;
+    bookFingerprint = 0;
+    bankStats.accounts = 0;
+    merkleFree(&liveMerkle);
+    indexFree();
+    packedFree();
+    activityFree();
+    balanceIntegralsFree();
+    loanBookFree();
+    poolRelease(&accountPool);
+    poolRelease(&namePool);
+    poolRelease(&indexPool);
+}
+
+// Copies an input token into a fixed-size buffer, truncating it if it is too long.
+void copyToken(char *dest, size_t size, const char *token) {
+    strncpy(dest, token, size - 1);
+    dest[size - 1] = '\0';
+}
+
+// Highest account number seen while applying the log; finalizeAllocator() continues after it.
+int walHighestAccountNumber = FIRST_ACCOUNT_NUMBER - 1;
+
+// Applies one log record to the book; see walApplyRecord().
+long long walApplyChange(const char *line) {
+    char kind;
+    long long time;
+    int accountNumber, type, consumed = 0;
+    float amount;
+    int fields = sscanf(line, "%c %lld %d%n", &kind, &time, &accountNumber, &consumed);
+    if (fields == 2 && kind == 'A') {
+        restartAccrualPeriods(changeTime());
+        return time;
+    }
+    if (fields != 3) {
+        return -1;
+    }
+    const char *rest = line + consumed;
+    if (kind == 'L') {
+        long long principal, monthlyRate, emi;
+        if (sscanf(rest, "%lld %lld %lld", &principal, &monthlyRate, &emi) != 3 || principal <= 0 || emi <= 0 ||
+            monthlyRate < 0 || monthlyRate >= (1LL << LOAN_RATE_BITS) || loanAdd(accountNumber, principal, monthlyRate, emi) < 0) {
+            return -1;
+        }
+        return time;
+    }
+    if (kind == 'P') {
+        long long principal;
+        if (accountNumber < 0 || (size_t)accountNumber >= loanBook.count || sscanf(rest, "%lld", &principal) != 1 || principal < 0) {
+            return -1;
+        }
+        loanBook.principal[accountNumber] = principal;
+        if (principal == 0) {
+            loanBook.account[accountNumber] = 0; // Settled
+        }
+        return time;
+    }
+    if (kind == 'C') {
+        char name[REPLICA_NAME_LEN];
+        if (sscanf(rest, "%d %f %49s", &type, &amount, name) != 3 || type < 0 || type >= ACCOUNT_TYPE_COUNT) {
+            return -1;
+        }
+        if (findAccountByNumber(accountNumber) != NULL || coldRecordOf(accountNumber) != 0) {
+            return -1; // The ordered stores refuse a second account with the same number
+        }
+        AccountNode *new_node = (AccountNode *)poolAlloc(&accountPool);
+        if (!new_node) {
+            perror("Failed to allocate memory for new account node");
+            return -1;
+        }
+        new_node->Name = nameIntern(name);
+        if (!new_node->Name) {
+            perror("Failed to allocate memory for account name");
+            poolFree(&accountPool, new_node);
+            return -1;
+        }
+        new_node->AccountNumber = accountNumber;
+        new_node->accountType = (AccountType)type;
+        new_node->Amount = amount;
+        if (accountCreated(new_node) != 0) {
+            nameRelease(new_node->Name);
+            poolFree(&accountPool, new_node);
+            return -1;
+        }
+        if (accountStore == STORE_LIST) {
+            new_node->next = accountsHead; // Order does not matter; reports sort the list
+            accountsHead = new_node;
+            orderedTail = NULL;            // The prefix no longer starts at the head
+        }
+        if (accountNumber > walHighestAccountNumber) {
+            walHighestAccountNumber = accountNumber;
+        }
+    } else if (kind == 'B') {
+        AccountNode *node = accountFind(accountNumber);
+        if (node == NULL || sscanf(rest, "%f", &amount) != 1) {
+            return -1;
+        }
+        float oldAmount = node->Amount;
+        AccountStripe *stripe = accountStripe(node->AccountNumber);
+        stripeWriteBegin(stripe);
+        node->Amount = amount;
+        stripeWriteEnd(stripe);
+        balanceChanged(node, oldAmount);
+    } else if (kind == 'D') {
+        AccountNode *node = accountFind(accountNumber); // Brings an evicted account back first
+        if (accountStore != STORE_LIST) {
+            if (node == NULL) {
+                return -1;
+            }
+            accountDeleted(node); // Removes it from the store
+            retireAccountNode(node);
+            return time;
+        }
+        AccountNode **link = &accountsHead;
+        while (*link != NULL && (*link)->AccountNumber != accountNumber) {
+            link = &(*link)->next;
+        }
+        node = *link;
+        if (node == NULL) {
+            return -1;
+        }
+        accountDeleted(node);
+        *link = node->next;
+        if (node == orderedTail) {
+            orderedTail = NULL; // The predecessor is not at hand; the next report sorts everything
+        }
+        retireAccountNode(node);
+    } else {
+        return -1;
+    }
+    return time;
+}
+
+// Applies one log record to the book without printing anything. While it does, the record's
+// timestamp stands for the current time (see changeTime()), so last activity and the like
+// come out as they were on the primary rather than as of the replay.
+// Returns the record's timestamp, or -1 if the line is not a valid record.
+long long walApplyRecord(const char *line) {
+    if (sscanf(line, "%*c %lld", &walReplayMicros) != 1 || walReplayMicros < 0) {
+        walReplayMicros = 0;
+        return -1;
+    }
+    long long time = walApplyChange(line);
+    walReplayMicros = 0;
+    return time;
+}
+
+// Rebuilds the account number allocator from the accounts that exist after replay:
+// new numbers continue after the highest number ever used, and every lower number
+// that is not in use goes to the recycled list, smallest first.
+void finalizeAllocator(void) {
+    if (walHighestAccountNumber + 1 > globalNextAccountNumber) {
+        globalNextAccountNumber = walHighestAccountNumber + 1;
+    }
+    int range = globalNextAccountNumber - FIRST_ACCOUNT_NUMBER;
+    char *used = (char *)calloc(range > 0 ? (size_t)range : 1, 1);
+    if (!used) {
+        perror("Failed to allocate memory for allocator rebuild");
+        return;
+    }
+    AccountCursor cursor = allAccounts();
+    for (AccountNode *node; (node = cursorNext(&cursor)) != NULL;) {
+        if (node->AccountNumber >= FIRST_ACCOUNT_NUMBER && node->AccountNumber < globalNextAccountNumber) {
+            used[node->AccountNumber - FIRST_ACCOUNT_NUMBER] = 1;
+        }
+    }
+    while (deletedAccountNumbersHead != NULL) {
+        DeletedAccountNumNode *next = deletedAccountNumbersHead->next;
+        free(deletedAccountNumbersHead);
+        deletedAccountNumbersHead = next;
+    }
+    DeletedAccountNumNode **tail = &deletedAccountNumbersHead;
+    for (int i = 0; i < range; i++) {
+        if (used[i]) {
+            continue;
+        }
+        DeletedAccountNumNode *new_node = (DeletedAccountNumNode *)malloc(sizeof(DeletedAccountNumNode));
+        if (!new_node) {
+            perror("Failed to allocate memory for new deleted account number node");
+            break;
+        }
+        new_node->AccountNum = FIRST_ACCOUNT_NUMBER + i;
+        new_node->next = NULL;
+        *tail = new_node;
+        tail = &new_node->next;
+    }
+    free(used);
+}
+
+// Incremental reader of a log file that may still be growing.
+typedef struct WalReader {
+    int fd;                 // Log file, -1 until it exists
+    char path[512];         // Path of the log file
+    char buf[4096];         // Bytes read but not yet applied (at most one partial line)
+    size_t len;             // Number of bytes in buf
+    long long appliedRecords;
+    long long appliedBytes;
+    long long lastRecordTime;   // Primary's timestamp of the newest applied record
+    long long lastApplyLag;     // Microseconds between the primary logging and us applying the newest record
+    long long maxApplyLag;      // Worst apply lag seen
+    long long badRecords;       // Lines that could not be applied
+} WalReader;
+
+// Applies every complete record appended to the log since the last call.
+// Returns the number of records applied.
+long long walReaderPoll(WalReader *reader) {
+    if (reader->fd < 0) {
+        reader->fd = open(reader->path, O_RDONLY);
+        if (reader->fd < 0) {
+            return 0; // Primary has not created the log yet
+        }
+    }
+    long long applied = 0;
+    while (1) {
+        ssize_t n = read(reader->fd, reader->buf + reader->len, sizeof(reader->buf) - 1 - reader->len);
+        if (n <= 0) {
+            break;
+        }
+        reader->len += (size_t)n;
+        reader->buf[reader->len] = '\0';
+        char *start = reader->buf;
+        char *end;
+        while ((end = strchr(start, '\n')) != NULL) {
+            *end = '\0';
+            long long time = walApplyRecord(start);
+            if (time < 0) {
+                reader->badRecords++;
+            } else {
+                reader->lastRecordTime = time;
+                reader->lastApplyLag = nowMicros() - time;
+                if (reader->lastApplyLag > reader->maxApplyLag) {
+                    reader->maxApplyLag = reader->lastApplyLag;
+                }
+                applied++;
+            }
+            reader->appliedBytes += end + 1 - start;
+            start = end + 1;
+        }
+        reader->len -= (size_t)(start - reader->buf);
+        memmove(reader->buf, start, reader->len);
+        if (reader->len == sizeof(reader->buf) - 1) {
+            reader->len = 0; // A line longer than any valid record: drop it
+            reader->badRecords++;
+        }
+    }
+    reader->appliedRecords += applied;
+    return applied;
+}
+
+// Replays the log in 'dir' into the book and reopens it for appending.
+// Used by a primary on startup. Returns 1 on success, 0 on failure.
+int walRecover(const char *dir) {
+    WalReader reader;
+    memset(&reader, 0, sizeof(reader));
+    reader.fd = -1;
+    walPath(reader.path, sizeof(reader.path), dir);
+    walReaderPoll(&reader);
+    if (reader.fd >= 0) {
+        close(reader.fd);
+        finalizeAllocator();
+        if (reader.appliedRecords > 0) {
+            printf("Recovered %lld log record(s) from %s\n", reader.appliedRecords, reader.path);
+        }
+    }
+    return walOpenForAppend(dir);
+}
+
+// Prints the replication status of a standby.
+void standbyStatus(WalReader *reader) {
+    struct stat st;
+    long long behind = 0;
+    if (reader->fd >= 0 && fstat(reader->fd, &st) == 0) {
+        behind = (long long)st.st_size - reader->appliedBytes;
+    }
+    fprintf(bankOut, "Standby of %s\n", reader->path);
+    fprintf(bankOut, "Applied records: %lld (%lld bytes, %lld invalid)\n", reader->appliedRecords, reader->appliedBytes, reader->badRecords);
+    fprintf(bankOut, "Bytes behind primary: %lld\n", behind);
+    fprintf(bankOut, "Replication lag: %.3f ms (max %.3f ms)\n", reader->lastApplyLag / 1000.0, reader->maxApplyLag / 1000.0);
+    fprintf(bankOut, "State fingerprint: %016llx\n", (unsigned long long)stateHash());
+    if (reader->appliedRecords > 0) {
+        fprintf(bankOut, "Last record applied %.3f ms after it was logged, %.3f s ago\n",
+                reader->lastApplyLag / 1000.0, (nowMicros() - reader->lastRecordTime) / 1000000.0);
+    }
+}
+
+// Hot standby: tails the primary's log in 'dir' and applies it continuously.
+// Understands STATUS and PROMOTE on stdin. PROMOTE applies whatever is left in the log,
+// rebuilds the account number allocator, starts appending to the log and hands stdin to
+// an ordinary session. 'leftover' receives input typed after PROMOTE (size 'leftoverSize').
+// Returns 1 after a promotion, 0 if stdin closed first.
+int runStandby(const char *dir, char *leftover, size_t leftoverSize) {
+    WalReader reader;
+    memset(&reader, 0, sizeof(reader));
+    reader.fd = -1;
+    walPath(reader.path, sizeof(reader.path), dir);
+
+    // Wake up on log writes when the platform can tell us, otherwise poll every millisecond
+    int notifyFd = -1;
+#ifdef __linux__
+    notifyFd = inotify_init1(IN_NONBLOCK);
+    if (notifyFd >= 0 && inotify_add_watch(notifyFd, dir, IN_MODIFY | IN_CREATE) < 0) {
+        close(notifyFd);
+        notifyFd = -1;
+    }
+#endif
+
+    char input[256];
+    size_t inputLen = 0;
+    int promoted = 0;
+    int inputOpen = 1;
+    printf("Standby following %s. Commands: STATUS, PROMOTE\n", reader.path);
+    fflush(stdout);
+
+    while (inputOpen && !promoted) {
+        walReaderPoll(&reader);
+
+        struct pollfd fds[2];
+        fds[0].fd = STDIN_FILENO;
+        fds[0].events = POLLIN;
+        fds[1].fd = notifyFd;
+        fds[1].events = POLLIN;
+        if (poll(fds, notifyFd >= 0 ? 2 : 1, notifyFd >= 0 ? 1000 : 1) < 0 && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+        if (notifyFd >= 0 && (fds[1].revents & POLLIN)) {
+            char events[4096];
+            while (read(notifyFd, events, sizeof(events)) > 0) {
+                // Drain the events; the log is read on the next iteration either way
+            }
+        }
+        if (!(fds[0].revents & (POLLIN | POLLHUP))) {
+            continue;
+        }
+        ssize_t n = read(STDIN_FILENO, input + inputLen, sizeof(input) - 1 - inputLen);
+        if (n <= 0) {
+            inputOpen = 0;
+            break;
+        }
+        inputLen += (size_t)n;
+        input[inputLen] = '\0';
+
+        // Handle complete commands, one per whitespace-separated token
+        char *start = input;
+        while (!promoted) {
+            start += strspn(start, " \t\r\n");
+            size_t tokenLen = strcspn(start, " \t\r\n");
+            if (start[tokenLen] == '\0') {
+                break; // Incomplete token; wait for more input
+            }
+            start[tokenLen] = '\0';
+            if (strcmp(start, "STATUS") == 0) {
+                walReaderPoll(&reader);
+                standbyStatus(&reader);
+            } else if (strcmp(start, "PROMOTE") == 0) {
+                promoted = 1;
+            } else {
+                fprintf(bankOut, "Invalid command: '%s'. The standby only accepts STATUS and PROMOTE.\n", start);
+            }
+            start += tokenLen + 1;
+        }
+        inputLen = strlen(start);
+        memmove(input, start, inputLen + 1);
+        fflush(stdout);
+    }
+
+    if (notifyFd >= 0) {
+        close(notifyFd);
+    }
+    if (!promoted) {
+        if (reader.fd >= 0) {
+            close(reader.fd);
+        }
+        return 0;
+    }
+
+    long long startTime = nowMicros();
+    walReaderPoll(&reader);
+    if (reader.fd >= 0) {
+        close(reader.fd);
+    }
+    finalizeAllocator();
+    if (!walOpenForAppend(dir)) {
+        return 0;
+    }
+    printf("Promoted to primary in %.3f ms after applying %lld record(s); next new account number is %d\n",
+           (nowMicros() - startTime) / 1000.0, reader.appliedRecords, globalNextAccountNumber);
+    copyToken(leftover, leftoverSize, input);
+    return 1;
+}
+
+// Copies a consistent version of every slot of a running process's shared-memory replica.
+// Returns a malloc'ed array indexed by slot (unused slots have accountNumber 0) and its
+// length in *count, or NULL on failure.
+ReplicaRecord *replicaLoad(const char *name, uint32_t *count) {
+    char shmName[64];
+    snprintf(shmName, sizeof(shmName), "%s%s", name[0] == '/' ? "" : "/", name);
+    int fd = shm_open(shmName, O_RDONLY, 0);
+    if (fd < 0) {
+        perror("Failed to open replica shared memory");
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(ReplicaHeader)) {
+        fprintf(stderr, "Replica '%s' is not initialised\n", shmName);
+        close(fd);
+        return NULL;
+    }
+    void *mem = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) {
+        perror("Failed to map replica shared memory");
+        return NULL;
+    }
+    ReplicaHeader *header = (ReplicaHeader *)mem;
+    ReplicaRecord *records = (ReplicaRecord *)(header + 1);
+    if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != REPLICA_MAGIC ||
+        replicaSize(header->capacity) > (size_t)st.st_size) {
+        fprintf(stderr, "Replica '%s' is not initialised\n", shmName);
+        munmap(mem, (size_t)st.st_size);
+        return NULL;
+    }
+
+    uint32_t highWater = __atomic_load_n(&header->highWater, __ATOMIC_ACQUIRE);
+    ReplicaRecord *copies = (ReplicaRecord *)malloc((highWater ? highWater : 1) * sizeof(ReplicaRecord));
+    if (!copies) {
+        perror("Failed to allocate memory for replica copy");
+        munmap(mem, (size_t)st.st_size);
+        return NULL;
+    }
+    for (uint32_t i = 0; i < highWater; i++) {
+        ReplicaRecord *r = &records[i];
+        ReplicaRecord *copy = &copies[i];
+        uint32_t before, after;
+        do {
+            before = __atomic_load_n(&r->seq, __ATOMIC_ACQUIRE);
+            memcpy(copy, r, sizeof(ReplicaRecord));
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            after = __atomic_load_n(&r->seq, __ATOMIC_RELAXED);
+        } while ((before & 1) || before != after); // Writer was active: try again
+        copy->name[REPLICA_NAME_LEN - 1] = '\0';
+    }
+    munmap(mem, (size_t)st.st_size);
+    *count = highWater;
+    return copies;
+}
+
+// Snapshots.
+// SNAPSHOT writes the book to a file: a "BANKSNAP 4 <accounts> <fingerprint> <names> <blocks>
+// <bytes>" header line, the name dictionary of the book (its block offsets, then its bytes,
+// in host byte order), one "<number> <type> <amount> <name ID>" line per account and then
+// the loan book: a "LOANS <count>" line and one "<account> <principal> <rate> <EMI>" line per
+// loan, in loan number order (amounts in paise, an account of 0 for a settled loan).
+// Version 3 snapshots recorded a fingerprint with an older key hash, which is not checked;
+// version 2 ones have no loans; version 1 ones, with the name itself at the end of each
+// account line, can still be read.
+#define SNAPSHOT_MAGIC "BANKSNAP"
+
+// Writes the book to 'path'. Returns 1 on success, 0 on failure.
+int snapshotWrite(const char *path) {
+    if (packedNamesCompact() < 0) { // Puts every name in the dictionary
+        perror("Failed to build the snapshot name dictionary");
+        return 0;
+    }
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        perror("Failed to create snapshot");
+        return 0;
+    }
+    long count = bankStats.accounts;
+    fprintf(file, "%s 4 %ld %016llx %u %u %u\n", SNAPSHOT_MAGIC, count, (unsigned long long)stateHash(),
+            packedDict.count, packedDict.blockCount, packedDict.size);
+    fwrite(packedDict.blockOffsets, sizeof(uint32_t), packedDict.blockCount, file);
+    fwrite(packedDict.data, 1, packedDict.size, file);
+    AccountCursor cursor = bookAccounts();
+    for (AccountNode *node; (node = cursorNext(&cursor)) != NULL;) {
+        PackedAccount *record = packedRecord(node->AccountNumber);
+        fprintf(file, "%d %d %.9g %u\n", node->AccountNumber, (int)node->accountType, node->Amount,
+                record != NULL ? record->nameOffset & ~PACKED_NAME_IN_DICT : 0);
+    }
+    fprintf(file, "LOANS %zu\n", loanBook.count);
+    for (size_t i = 0; i < loanBook.count; i++) {
+        fprintf(file, "%d %lld %lld %lld\n", loanBook.account[i], (long long)loanBook.principal[i],
+                (long long)loanBook.monthlyRate[i], (long long)loanBook.emi[i]);
+    }
+    int ok = fflush(file) == 0 && !ferror(file);
+    if (fclose(file) != 0 || !ok) {
+        perror("Failed to write snapshot");
+        return 0;
+    }
+    return 1;
+}
+
+// Lists the accounts without activity in the last 'days' days, oldest day first, and
+// flags them dormant in their packed records. Only the day lists before the cutoff are
+// walked, so this costs O(days + result) rather than a scan of the book. Evicted accounts
+// are listed from their packed records without being faulted back in.
+void dormantAccounts(int days) {
+    uint32_t today = (uint32_t)time(NULL) / SECONDS_PER_DAY;
+    uint32_t cutoff = days >= 0 && (uint32_t)days < today ? today - (uint32_t)days : 0; // Last active before this day
+    fprintf(bankOut, "Accounts without activity for %d day(s) or more:\n", days);
+    fprintf(bankOut, "Account Number\t\tAccount Type\t\tName                                              \t\tLast Activity\t     Balance\n");
+    fprintf(bankOut, "----------------------------------------------------------------------------------------------------------------------------------------\n");
+    long long found = 0, flagged = 0;
+    for (uint32_t day = firstDay; day < cutoff && day - firstDay < dayCount; day++) {
+        for (uint32_t link = dayHeads[day - firstDay]; link != 0; link = activityTable[link - 1].next) {
+            PackedAccount *record = &packedTable[link - 1];
+            if (!packedLive(record)) {
+                continue;
+            }
+            if (!(record->numberFlags & PACKED_DORMANT)) {
+                record->numberFlags |= PACKED_DORMANT;
+                flagged++;
+            }
+            char name[NAME_DICT_MAX_NAME];
+            char date[16];
+            time_t last = (time_t)activityTable[link - 1].time;
+            struct tm tm;
+            strftime(date, sizeof(date), "%Y-%m-%d", gmtime_r(&last, &tm));
+            fprintf(bankOut, "%u\t\t\t%s\t\t\t%-50s\t\t%s\t%12.2f\n", record->numberFlags & PACKED_NUMBER_MASK,
+                    accountPolicies[packedType(record)].name,
+                    packedNameCopy(record, name, sizeof(name)), date, record->balance / 100.0);
+            found++;
+        }
+    }
+    if (found == 0) {
+        fprintf(bankOut, "No dormant accounts found\n");
+    }
+    fprintf(bankOut, "----------------------------------------------------------------------------------------------------------------------------------------\n");
+    fprintf(bankOut, "%lld dormant account(s), %lld newly flagged\n", found, flagged);
+}
+
+// Writes every account to 'path' as "<name>,<type>,<number>,<balance>" lines ordered by
+// name, streaming the names from the dictionary. Returns the number of accounts written,
+// or -1 on failure.
+long long exportByName(const char *path) {
+    if (packedNamesCompact() < 0) { // Puts every name in the dictionary
+        perror("Failed to build the name dictionary");
+        return -1;
+    }
+    // Counting sort of the account slots by name ID
+    uint32_t *first = (uint32_t *)calloc((size_t)packedDict.count + 1, sizeof(uint32_t));
+    uint32_t *order = (uint32_t *)malloc((packedHighWater ? packedHighWater : 1) * sizeof(uint32_t));
+    FILE *file = first && order ? fopen(path, "w") : NULL;
+    if (!file) {
+        perror(first && order ? "Failed to create export file" : "Failed to allocate memory for export");
+        free(first);
+        free(order);
+        return -1;
+    }
+    for (uint32_t slot = 0; slot < packedHighWater; slot++) {
+        if (packedLive(&packedTable[slot])) {
+            first[(packedTable[slot].nameOffset & ~PACKED_NAME_IN_DICT) + 1]++;
+        }
+    }
+    for (uint32_t id = 0; id < packedDict.count; id++) {
+        first[id + 1] += first[id];
+    }
+    for (uint32_t slot = 0; slot < packedHighWater; slot++) {
+        if (packedLive(&packedTable[slot])) {
+            order[first[packedTable[slot].nameOffset & ~PACKED_NAME_IN_DICT]++] = slot;
+        }
+    }
+    // first[id] now marks the end of the accounts of name 'id'
+    NameDictCursor cursor;
+    nameDictSeek(&cursor, &packedDict, 0);
+    long long written = 0;
+    for (const char *name; (name = nameDictNext(&cursor)) != NULL;) {
+        for (; written < first[cursor.id - 1]; written++) {
+            const PackedAccount *record = &packedTable[order[written]];
+            fprintf(file, "%s,%s,%u,%.2f\n", name, accountPolicies[packedType(record)].name,
+                    record->numberFlags & PACKED_NUMBER_MASK, record->balance / 100.0);
+        }
+    }
+    free(first);
+    free(order);
+    int ok = fflush(file) == 0 && !ferror(file);
+    if (fclose(file) != 0 || !ok) {
+        perror("Failed to write export file");
+        return -1;
+    }
+    return written;
+}
+
+// Returns the hash of a record, the same way accountHash() hashes a live account.
+uint64_t recordHash(const ReplicaRecord *r) {
+    AccountNode node;
+    node.AccountNumber = r->accountNumber;
+    node.Name = (char *)r->name;
+    node.accountType = (AccountType)r->accountType;
+    node.keyHash = accountKeyHash(&node);
+    return accountHashWithAmount(&node, r->amount);
+}
+
+// Reads the name dictionary of a version 2 snapshot, which follows the header line.
+// Returns 1 on success, 0 on failure.
+int snapshotReadDict(FILE *file, NameDict *dict) {
+    memset(dict, 0, sizeof(*dict));
+    if (fscanf(file, "%u %u %u", &dict->count, &dict->blockCount, &dict->size) != 3 || fgetc(file) != '\n' ||
+        dict->blockCount != (dict->count + NAME_DICT_BLOCK - 1) / NAME_DICT_BLOCK) {
+        return 0;
+    }
+    dict->blockOffsets = (uint32_t *)malloc((dict->blockCount ? dict->blockCount : 1) * sizeof(uint32_t));
+    dict->data = (unsigned char *)malloc(dict->size ? dict->size : 1);
+    if (dict->blockOffsets == NULL || dict->data == NULL ||
+        fread(dict->blockOffsets, sizeof(uint32_t), dict->blockCount, file) != dict->blockCount ||
+        fread(dict->data, 1, dict->size, file) != dict->size) {
+        nameDictFree(dict);
+        return 0;
+    }
+    if (!nameDictCheck(dict)) {
+        nameDictFree(dict); // Would decode outside the data or the name buffer
+        return 0;
+    }
+    return 1;
+}
+
+// Reads a snapshot into an array indexed by slot (AccountNumber - FIRST_ACCOUNT_NUMBER),
+// like replicaLoad(). Checks the records against the fingerprint in the header.
+// Returns NULL on failure.
+ReplicaRecord *snapshotLoad(const char *path, uint32_t *count) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        perror("Failed to open snapshot");
+        return NULL;
+    }
+    char magic[16];
+    int version;
+    long accounts;
+    unsigned long long fingerprint;
+    NameDict dict;
+    memset(&dict, 0, sizeof(dict));
+    if (fscanf(file, "%15s %d %ld %llx", magic, &version, &accounts, &fingerprint) != 4 ||
+        strcmp(magic, SNAPSHOT_MAGIC) != 0 || version < 1 || version > 4 ||
+        (version >= 2 && !snapshotReadDict(file, &dict))) {
+        fprintf(stderr, "'%s' is not a bank snapshot\n", path);
+        fclose(file);
+        return NULL;
+    }
+    ReplicaRecord *slots = NULL;
+    uint32_t capacity = 0;
+    uint32_t used = 0;
+    uint64_t sum = 0;
+    ReplicaRecord r;
+    memset(&r, 0, sizeof(r));
+    for (;;) {
+        unsigned int nameId;
+        if (version == 1 && fscanf(file, "%d %d %f %49s", &r.accountNumber, &r.accountType, &r.amount, r.name) != 4) {
+            break;
+        }
+        if (version >= 2) { // The accounts end at the loan book, if any
+            if (fscanf(file, "%d %d %f %u", &r.accountNumber, &r.accountType, &r.amount, &nameId) != 4) {
+                break;
+            }
+            nameDictGet(&dict, nameId, r.name, sizeof(r.name));
+        }
+        if (r.accountNumber < FIRST_ACCOUNT_NUMBER || r.accountType < 0 || r.accountType >= ACCOUNT_TYPE_COUNT) {
+            continue;
+        }
+        uint32_t slot = (uint32_t)(r.accountNumber - FIRST_ACCOUNT_NUMBER);
+        if (slot >= capacity) {
+            uint32_t newCapacity = capacity ? capacity : 1024;
+            while (newCapacity <= slot) {
+                newCapacity *= 2;
+            }
+            ReplicaRecord *grown = (ReplicaRecord *)realloc(slots, newCapacity * sizeof(ReplicaRecord));
+            if (!grown) {
+                perror("Failed to allocate memory for snapshot");
+                free(slots);
+                nameDictFree(&dict);
+                fclose(file);
+                return NULL;
+            }
+            memset(grown + capacity, 0, (newCapacity - capacity) * sizeof(ReplicaRecord));
+            slots = grown;
+            capacity = newCapacity;
+        }
+        slots[slot] = r;
+        sum += recordHash(&r);
+        if (slot + 1 > used) {
+            used = slot + 1;
+        }
+    }
+    fclose(file);
+    nameDictFree(&dict);
+    if (version >= 4 && sum != fingerprint) { // Older versions used another key hash
+        fprintf(stderr, "Warning: snapshot '%s' does not match its recorded fingerprint\n", path);
+    }
+    if (slots == NULL) {
+        slots = (ReplicaRecord *)calloc(1, sizeof(ReplicaRecord));
+    }
+    *count = used;
+    return slots;
+}
+
+// Loads a comparison source: "shm:<name>" reads a running process's replica,
+// anything else is a snapshot file.
+ReplicaRecord *auditSourceLoad(const char *source, uint32_t *count) {
+    if (strncmp(source, "shm:", 4) == 0) {
+        return replicaLoad(source + 4, count);
+    }
+    return snapshotLoad(source, count);
+}
+
+// Builds a Merkle tree over an array of slots.
+int merkleBuild(MerkleTree *t, const ReplicaRecord *slots, uint32_t count) {
+    memset(t, 0, sizeof(*t));
+    if (!merkleEnsureLeaves(t, (count + MERKLE_LEAF_SPAN - 1) / MERKLE_LEAF_SPAN)) {
+        return 0;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        if (slots[i].accountNumber != 0) {
+            t->nodes[t->leafCapacity + i / MERKLE_LEAF_SPAN] += recordHash(&slots[i]);
+        }
+    }
+    t->rebuild = 1;
+    merkleRefresh(t);
+    return 1;
+}
+
+// Collects the leaves whose hashes differ, descending only into mismatching subtrees.
+// Both trees must have the same leaf capacity. Returns the number of tree nodes visited.
+long merkleDiff(const MerkleTree *a, const MerkleTree *b, uint32_t node, uint32_t *leaves, uint32_t *leafCount) {
+    if (a->nodes[node] == b->nodes[node]) {
+        return 1;
+    }
+    if (node >= a->leafCapacity) {
+        leaves[(*leafCount)++] = node - a->leafCapacity;
+        return 1;
+    }
+    return 1 + merkleDiff(a, b, 2 * node, leaves, leafCount) + merkleDiff(a, b, 2 * node + 1, leaves, leafCount);
+}
+
+// Prints one account of an audit comparison, or a dash if it does not exist on that side.
+void printAuditRecord(const char *label, const ReplicaRecord *r) {
+    if (r == NULL || r->accountNumber == 0) {
+        fprintf(bankOut, "  %s: -\n", label);
+    } else {
+        fprintf(bankOut, "  %s: %s %s Rs %.2f\n", label, accountPolicies[r->accountType].name, r->name, r->amount);
+    }
+}
+
+// Compares two books given as Merkle trees plus slot arrays and prints every account
+// that differs. Only mismatching subtrees are visited, so the work is
+// O(differences * log N). 'liveA' means side A is the live book: its tree is the
+// maintained one and its slots are only materialised if something differs.
+// Returns the number of differing accounts, or -1 on failure.
+long auditCompare(MerkleTree *a, ReplicaRecord *slotsA, uint32_t countA, int liveA,
+                  MerkleTree *b, ReplicaRecord *slotsB, uint32_t countB,
+                  const char *labelA, const char *labelB) {
+    // Compare trees of equal shape: widen the smaller one. An empty book has no tree yet, so
+    // both get at least one leaf and merkleDiff() always has a root to start from.
+    uint32_t leaves = a->leafCapacity > b->leafCapacity ? a->leafCapacity : b->leafCapacity;
+    if (leaves == 0) {
+        leaves = 1;
+    }
+    if (!merkleEnsureLeaves(a, leaves) || !merkleEnsureLeaves(b, leaves)) {
+        return -1;
+    }
+    merkleRefresh(a);
+    merkleRefresh(b);
+
+    uint32_t *mismatches = (uint32_t *)malloc(leaves * sizeof(uint32_t));
+    if (!mismatches) {
+        perror("Failed to allocate memory for audit");
+        return -1;
+    }
+    uint32_t mismatchCount = 0;
+    long visited = merkleDiff(a, b, 1, mismatches, &mismatchCount);
+
+    ReplicaRecord *ownedA = NULL;
+    if (liveA && mismatchCount > 0) {
+        // Materialise only the live accounts of mismatching leaves, through the index
+        countA = a->leafCapacity * MERKLE_LEAF_SPAN;
+        ownedA = (ReplicaRecord *)calloc(countA, sizeof(ReplicaRecord));
+        if (!ownedA) {
+            perror("Failed to allocate memory for audit");
+            free(mismatches);
+            return -1;
+        }
+        for (uint32_t i = 0; i < mismatchCount; i++) {
+            uint32_t first = mismatches[i] * MERKLE_LEAF_SPAN;
+            for (uint32_t slot = first; slot < first + MERKLE_LEAF_SPAN; slot++) {
+                AccountNode copy;
+                AccountNode *node = findAccountByNumber((int)slot + FIRST_ACCOUNT_NUMBER);
+                if (node == NULL && coldPeek((int)slot + FIRST_ACCOUNT_NUMBER, &copy)) {
+                    node = &copy; // Evicted
+                }
+                if (node != NULL) {
+                    ReplicaRecord *r = &ownedA[slot];
+                    r->accountNumber = node->AccountNumber;
+                    r->accountType = node->accountType;
+                    r->amount = node->Amount;
+                    copyToken(r->name, sizeof(r->name), node->Name);
+                }
+            }
+        }
+        slotsA = ownedA;
+    }
+
+    long differences = 0;
+    for (uint32_t i = 0; i < mismatchCount; i++) {
+        uint32_t first = mismatches[i] * MERKLE_LEAF_SPAN;
+        for (uint32_t slot = first; slot < first + MERKLE_LEAF_SPAN; slot++) {
+            ReplicaRecord *ra = slot < countA && slotsA[slot].accountNumber != 0 ? &slotsA[slot] : NULL;
+            ReplicaRecord *rb = slot < countB && slotsB[slot].accountNumber != 0 ? &slotsB[slot] : NULL;
+            if (ra == NULL && rb == NULL) {
+                continue;
+            }
+            if (ra != NULL && rb != NULL && recordHash(ra) == recordHash(rb)) {
+                continue;
+            }
+            fprintf(bankOut, "Account %u differs:\n", slot + FIRST_ACCOUNT_NUMBER);
+            printAuditRecord(labelA, ra);
+            printAuditRecord(labelB, rb);
+            differences++;
+        }
+    }
+    fprintf(bankOut, "%ld differing account(s) in %u leaf range(s); %ld tree node(s) visited\n",
+            differences, mismatchCount, visited);
+    free(ownedA);
+    free(mismatches);
+    return differences;
+}
+
+// DIFF command: compares the live book with a snapshot file or a replica ("shm:<name>").
+// The source is loaded before taking the book lock.
+void diffLiveBook(const char *source) {
+    uint32_t count;
+    ReplicaRecord *slots = auditSourceLoad(source, &count);
+    if (slots == NULL) {
+        return;
+    }
+    MerkleTree other;
+    if (!merkleBuild(&other, slots, count)) {
+        free(slots);
+        return;
+    }
+    pthread_mutex_lock(&bankLock);
+    auditCompare(&liveMerkle, NULL, 0, 1, &other, slots, count, "live", source);
+    pthread_mutex_unlock(&bankLock);
+    merkleFree(&other);
+    free(slots);
+}
+
+// Audit tool: compares two sources (snapshot files or "shm:<name>" replicas).
+// Returns the process exit status: 0 if they are identical, 1 otherwise.
+int auditDiff(const char *sourceA, const char *sourceB) {
+    uint32_t countA, countB;
+    ReplicaRecord *slotsA = auditSourceLoad(sourceA, &countA);
+    ReplicaRecord *slotsB = slotsA ? auditSourceLoad(sourceB, &countB) : NULL;
+    MerkleTree a, b;
+    long differences = -1;
+    if (slotsB != NULL && merkleBuild(&a, slotsA, countA)) {
+        if (merkleBuild(&b, slotsB, countB)) {
+            differences = auditCompare(&a, slotsA, countA, 0, &b, slotsB, countB, sourceA, sourceB);
+            merkleFree(&b);
+        }
+        merkleFree(&a);
+    }
+    free(slotsA);
+    free(slotsB);
+    return differences == 0 ? 0 : 1;
+}
+
+// Cuts [data, data + size) into 'partitions' ranges that start and end at line boundaries.
+// begins[i] and ends[i] receive the ranges; empty ranges are possible for tiny inputs.
+void splitAtLines(const char *data, size_t size, int partitions, const char **begins, const char **ends) {
+    const char *cursor = data;
+    const char *fileEnd = data + size;
+    for (int i = 0; i < partitions; i++) {
+        const char *end = i == partitions - 1 ? fileEnd : data + size / (size_t)partitions * (size_t)(i + 1);
+        if (end < cursor) {
+            end = cursor;
+        }
+        while (end < fileEnd && end > data && end[-1] != '\n') {
+            end++;
+        }
+        begins[i] = cursor;
+        ends[i] = end;
+        cursor = end;
+    }
+}
+
+// Returns how many threads to use for 'size' bytes of input, at least 'minPartition' each.
+int partitionCount(size_t size, size_t minPartition, int maxThreads) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int partitions = (int)(size / minPartition) + 1;
+    if (partitions > cpus) {
+        partitions = cpus > 0 ? (int)cpus : 1;
+    }
+    if (partitions > maxThreads) {
+        partitions = maxThreads;
+    }
+    return partitions;
+}
+
+// Reconciliation against an external statement.
+// RECONCILE reads a clearing file of "<account>,<balance>" rows (other lines, such as a
+// header, are counted as malformed and skipped) through a memory map. The file is cut
+// into partitions at line boundaries and each partition is checked by its own thread,
+// which probes the account number index for every row. Balances are compared in paise.
+#define RECONCILE_MAX_THREADS 64
+#define RECONCILE_MIN_PARTITION (1 << 20)
+
+// Kinds of reconciliation findings.
+typedef enum ReconcileKind {
+    RECONCILE_MISMATCH,     // Both sides have the account but the balances differ
+    RECONCILE_UNKNOWN       // The statement lists an account the book does not have
+} ReconcileKind;
+
+typedef struct ReconcileFinding {
+    int accountNumber;
+    long long statementPaise;   // Balance in the statement
+    long long bookPaise;        // Balance in the book (RECONCILE_MISMATCH only)
+    ReconcileKind kind;
+} ReconcileFinding;
+
+// Work and results of one partition.
+typedef struct ReconcilePartition {
+    const char *begin;          // First byte of the partition (start of a line)
+    const char *end;            // One past its last byte (end of a line or of the file)
+    unsigned char *seen;        // Shared: seen[slot] = 1 once the statement listed the account
+    uint32_t seenCount;         // Number of entries in 'seen'
+    ReconcileFinding *findings; // Findings in file order
+    size_t findingCount;
+    size_t findingCapacity;
+    long long rows;             // Well-formed rows
+    long long malformed;        // Lines that are not "<account>,<balance>"
+    int failed;                 // Ran out of memory
+} ReconcilePartition;
+
+// Parses "<digits>,<[-]digits[.digits]>" in [p, end). Returns 1 and the values on success.
+int parseStatementRow(const char *p, const char *end, int *accountNumber, long long *paise) {
+    long long number = 0;
+    const char *digits = p;
+    while (p < end && *p >= '0' && *p <= '9' && number < 1000000000LL) {
+        number = number * 10 + (*p++ - '0');
+    }
+    if (p == digits || p >= end || *p != ',') {
+        return 0;
+    }
+    p++;
+    int negative = 0;
+    if (p < end && *p == '-') {
+        negative = 1;
+        p++;
+    }
+    long long whole = 0;
+    digits = p;
+    while (p < end && *p >= '0' && *p <= '9' && whole < 100000000000000LL) {
+        whole = whole * 10 + (*p++ - '0');
+    }
+    if (p == digits) {
+        return 0;
+    }
+    long long fraction = 0;
+    if (p < end && *p == '.') {
+        p++;
+        int places = 0;
+        while (p < end && *p >= '0' && *p <= '9') {
+            if (places < 3) {
+                fraction = fraction * 10 + (*p - '0');
+            }
+            places++;
+            p++;
+        }
+        while (places < 3) {
+            fraction *= 10;
+            places++;
+        }
+        fraction = (fraction + 5) / 10; // Three decimals rounded to paise
+    }
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+        p++;
+    }
+    if (p != end) {
+        return 0;
+    }
+    *accountNumber = (int)number;
+    *paise = (negative ? -1 : 1) * (whole * 100 + fraction);
+    return 1;
+}
+
+// Records a finding of a partition.
+void reconcileAddFinding(ReconcilePartition *part, int accountNumber, long long statementPaise, long long bookPaise, ReconcileKind kind) {
+    if (part->findingCount == part->findingCapacity) {
+        size_t capacity = part->findingCapacity ? part->findingCapacity * 2 : 64;
+        ReconcileFinding *grown = (ReconcileFinding *)realloc(part->findings, capacity * sizeof(ReconcileFinding));
+        if (!grown) {
+            part->failed = 1;
+            return;
+        }
+        part->findings = grown;
+        part->findingCapacity = capacity;
+    }
+    ReconcileFinding *f = &part->findings[part->findingCount++];
+    f->accountNumber = accountNumber;
+    f->statementPaise = statementPaise;
+    f->bookPaise = bookPaise;
+    f->kind = kind;
+}
+
+// Thread body: checks every row of one partition against the book.
+void *reconcileWorker(void *arg) {
+    ReconcilePartition *part = (ReconcilePartition *)arg;
+    const char *p = part->begin;
+    while (p < part->end) {
+        const char *lineEnd = memchr(p, '\n', (size_t)(part->end - p));
+        if (lineEnd == NULL) {
+            lineEnd = part->end;
+        }
+        int accountNumber;
+        long long paise;
+        if (lineEnd == p || (lineEnd == p + 1 && *p == '\r')) {
+            // Blank line
+        } else if (!parseStatementRow(p, lineEnd, &accountNumber, &paise)) {
+            part->malformed++;
+        } else {
+            part->rows++;
+            const PackedAccount *record = packedRecord(accountNumber);
+            if (record == NULL) {
+                reconcileAddFinding(part, accountNumber, paise, 0, RECONCILE_UNKNOWN);
+            } else {
+                part->seen[accountNumber - FIRST_ACCOUNT_NUMBER] = 1;
+                long long bookPaise = record->balance;
+                if (bookPaise != paise) {
+                    reconcileAddFinding(part, accountNumber, paise, bookPaise, RECONCILE_MISMATCH);
+                }
+            }
+        }
+        p = lineEnd + 1;
+    }
+    return NULL;
+}
+
+// Reconciles the book against the statement in 'path' and prints every difference.
+// Call with bankLock held so the book does not change underneath the worker threads.
+void reconcile(const char *path) {
+    long long startTime = monotonicNanos();
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("Failed to open statement");
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        perror("Failed to read statement");
+        close(fd);
+        return;
+    }
+    size_t size = (size_t)st.st_size;
+    const char *data = NULL;
+    if (size > 0) {
+        data = (const char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            perror("Failed to map statement");
+            close(fd);
+            return;
+        }
+        madvise((void *)data, size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    // Every account number the book can hold gets a "seen in statement" flag
+    uint32_t seenCount = (uint32_t)(globalNextAccountNumber - FIRST_ACCOUNT_NUMBER);
+    unsigned char *seen = (unsigned char *)calloc(seenCount ? seenCount : 1, 1);
+    int partitions = partitionCount(size, RECONCILE_MIN_PARTITION, RECONCILE_MAX_THREADS);
+    ReconcilePartition parts[RECONCILE_MAX_THREADS];
+    pthread_t threads[RECONCILE_MAX_THREADS];
+    const char *begins[RECONCILE_MAX_THREADS];
+    const char *ends[RECONCILE_MAX_THREADS];
+    memset(parts, 0, sizeof(parts));
+    if (!seen) {
+        perror("Failed to allocate memory for reconciliation");
+        if (data) {
+            munmap((void *)data, size);
+        }
+        return;
+    }
+
+    // Cut the file at line boundaries and check the partitions in parallel
+    splitAtLines(data, size, partitions, begins, ends);
+    for (int i = 0; i < partitions; i++) {
+        parts[i].begin = begins[i];
+        parts[i].end = ends[i];
+        parts[i].seen = seen;
+        parts[i].seenCount = seenCount;
+    }
+    int started = 0;
+    for (int i = 1; i < partitions; i++, started++) {
+        if (pthread_create(&threads[i], NULL, reconcileWorker, &parts[i]) != 0) {
+            break;
+        }
+    }
+    for (int i = started + 1; i < partitions; i++) {
+        reconcileWorker(&parts[i]); // Could not start a thread: do it here
+    }
+    reconcileWorker(&parts[0]);
+    for (int i = 1; i <= started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    // Report in file order, then the accounts the statement does not mention
+    long long rows = 0, malformed = 0, mismatched = 0, unknown = 0, missing = 0;
+    int failed = 0;
+    for (int i = 0; i < partitions; i++) {
+        rows += parts[i].rows;
+        malformed += parts[i].malformed;
+        failed |= parts[i].failed;
+        for (size_t j = 0; j < parts[i].findingCount; j++) {
+            ReconcileFinding *f = &parts[i].findings[j];
+            if (f->kind == RECONCILE_MISMATCH) {
+                fprintf(bankOut, "Mismatch: account %d statement Rs %.2f, book Rs %.2f\n",
+                        f->accountNumber, f->statementPaise / 100.0, f->bookPaise / 100.0);
+                mismatched++;
+            } else {
+                fprintf(bankOut, "Unknown: account %d (statement Rs %.2f) does not exist in the book\n",
+                        f->accountNumber, f->statementPaise / 100.0);
+                unknown++;
+            }
+        }
+        free(parts[i].findings);
+    }
+    for (uint32_t slot = 0; slot < seenCount; slot++) {
+        const PackedAccount *record;
+        if (!seen[slot] && (record = packedRecord((int)slot + FIRST_ACCOUNT_NUMBER)) != NULL) {
+            fprintf(bankOut, "Missing: account %d (book Rs %.2f) is not in the statement\n",
+                    (int)(record->numberFlags & PACKED_NUMBER_MASK), record->balance / 100.0);
+            missing++;
+        }
+    }
+    double seconds = (monotonicNanos() - startTime) / 1e9;
+    fprintf(bankOut, "Reconciled %lld row(s) with %d partition(s) in %.3f s (%.1f MB/s)\n",
+            rows, partitions, seconds, seconds > 0 ? size / 1e6 / seconds : 0.0);
+    fprintf(bankOut, "Mismatched: %lld, unknown: %lld, missing: %lld, malformed lines: %lld\n",
+            mismatched, unknown, missing, malformed);
+    if (failed) {
+        fprintf(bankOut, "Warning: ran out of memory; some findings were not reported\n");
+    }
+    free(seen);
+    if (data) {
+        munmap((void *)data, size);
+    }
+}
+
+// Clearing-file ingestion.
+// INGEST posts a clearing house file of fixed-width records in bulk:
+//   columns  1-10  account number (digits, zero padded)
+//   column  11     'C' for a credit (deposit) or 'D' for a debit (withdrawal)
+//   columns 12-26  amount in paise (digits, zero padded)
+//   columns 27-46  reference (free text)
+// followed by a newline (optionally "\r\n"). The file is memory mapped, cut into
+// partitions at line boundaries, and the records are parsed and format-checked by
+// parallel threads. Valid records are grouped by account
+// and posted through applyTransactionBatch() under the book lock. Every rejected record is
+// copied to the reject file followed by "|<reason>".
+#define INGEST_ACCOUNT_WIDTH 10
+#define INGEST_AMOUNT_WIDTH 15
+#define INGEST_REFERENCE_WIDTH 20
+#define INGEST_RECORD_WIDTH (INGEST_ACCOUNT_WIDTH + 1 + INGEST_AMOUNT_WIDTH + INGEST_REFERENCE_WIDTH)
+#define INGEST_MIN_PARTITION 65536 // Records
+#define INGEST_MAX_THREADS 64
+
+// A record that failed a check.
+typedef struct IngestReject {
+    long long offset;           // Byte offset of the record's line in the clearing file
+    const char *reason;         // Why it was rejected
+} IngestReject;
+
+// Work and results of one parser thread.
+typedef struct IngestPartition {
+    const char *data;           // Start of the mapped file
+    const char *begin;          // First byte of the partition (start of a line)
+    const char *end;            // One past its last byte
+    TransactionRequest *requests; // Valid records, tagged with their byte offset
+    size_t valid;
+    size_t requestCapacity;
+    long long lines;            // Non-blank lines seen
+    IngestReject *rejects;      // Format rejects
+    size_t rejectCount;
+    size_t rejectCapacity;
+    int failed;                 // Ran out of memory
+} IngestPartition;
+
+// Parses 'width' digits. Returns 1 and the value on success.
+int parseFixedDigits(const char *p, int width, long long *value) {
+    long long v = 0;
+    for (int i = 0; i < width; i++) {
+        if (p[i] < '0' || p[i] > '9') {
+            return 0;
+        }
+        v = v * 10 + (p[i] - '0');
+    }
+    *value = v;
+    return 1;
+}
+
+// Records a rejected line of a partition.
+void ingestAddReject(IngestPartition *part, long long offset, const char *reason) {
+    if (part->rejectCount == part->rejectCapacity) {
+        size_t capacity = part->rejectCapacity ? part->rejectCapacity * 2 : 64;
+        IngestReject *grown = (IngestReject *)realloc(part->rejects, capacity * sizeof(IngestReject));
+        if (!grown) {
+            part->failed = 1;
+            return;
+        }
+        part->rejects = grown;
+        part->rejectCapacity = capacity;
+    }
+    part->rejects[part->rejectCount].offset = offset;
+    part->rejects[part->rejectCount].reason = reason;
+    part->rejectCount++;
+}
+
+// Thread body: parses and format-checks the records of one partition.
+void *ingestParser(void *arg) {
+    IngestPartition *part = (IngestPartition *)arg;
+    const char *rec = part->begin;
+    while (rec < part->end) {
+        const char *lineEnd = memchr(rec, '\n', (size_t)(part->end - rec));
+        if (lineEnd == NULL) {
+            lineEnd = part->end;
+        }
+        size_t length = (size_t)(lineEnd - rec);
+        if (length > 0 && rec[length - 1] == '\r') {
+            length--;
+        }
+        long long offset = rec - part->data;
+        long long accountNumber, paise;
+        if (length == 0) {
+            // Blank line
+        } else if (part->lines++, length != INGEST_RECORD_WIDTH) {
+            ingestAddReject(part, offset, "bad record length");
+        } else if (!parseFixedDigits(rec, INGEST_ACCOUNT_WIDTH, &accountNumber) || accountNumber > 2147483647LL) {
+            ingestAddReject(part, offset, "bad account number");
+        } else if (rec[INGEST_ACCOUNT_WIDTH] != 'C' && rec[INGEST_ACCOUNT_WIDTH] != 'D') {
+            ingestAddReject(part, offset, "bad credit/debit flag");
+        } else if (!parseFixedDigits(rec + INGEST_ACCOUNT_WIDTH + 1, INGEST_AMOUNT_WIDTH, &paise) || paise == 0) {
+            ingestAddReject(part, offset, "bad amount");
+        } else {
+            if (part->valid == part->requestCapacity) {
+                size_t capacity = part->requestCapacity ? part->requestCapacity * 2 : 4096;
+                TransactionRequest *grown = (TransactionRequest *)realloc(part->requests, capacity * sizeof(TransactionRequest));
+                if (!grown) {
+                    part->failed = 1;
+                    return NULL;
+                }
+                part->requests = grown;
+                part->requestCapacity = capacity;
+            }
+            TransactionRequest *req = &part->requests[part->valid++];
+            req->accountNumber = (int)accountNumber;
+            req->amount = (float)(paise / 100.0);
+            req->code = rec[INGEST_ACCOUNT_WIDTH] == 'C' ? 1 : 0;
+            req->tag = offset;
+            req->result = TRANSACTION_OK;
+        }
+        rec = lineEnd + 1;
+    }
+    return NULL;
+}
+
+// Copies the record starting at 'offset' to the reject file, followed by its reason.
+void ingestWriteReject(FILE *rejectFile, const char *data, size_t size, long long offset, const char *reason) {
+    const char *rec = data + offset;
+    const char *lineEnd = memchr(rec, '\n', size - (size_t)offset);
+    size_t length = lineEnd ? (size_t)(lineEnd - rec) : size - (size_t)offset;
+    if (length > 0 && rec[length - 1] == '\r') {
+        length--;
+    }
+    fwrite(rec, 1, length, rejectFile);
+    fprintf(rejectFile, "|%s\n", reason);
+}
+
+// Compares two rejects by position in the file.
+int compareIngestRejects(const void *a, const void *b) {
+    const IngestReject *x = (const IngestReject *)a;
+    const IngestReject *y = (const IngestReject *)b;
+    return (x->offset > y->offset) - (x->offset < y->offset);
+}
+
+// Posts the clearing file at 'path' and writes rejected records to 'rejectPath'.
+// Takes the book lock only for the posting phase.
+void ingest(const char *path, const char *rejectPath) {
+    long long startTime = monotonicNanos();
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("Failed to open clearing file");
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        perror("Failed to read clearing file");
+        close(fd);
+        return;
+    }
+    size_t size = (size_t)st.st_size;
+    if (size == 0) {
+        fprintf(bankOut, "Clearing file %s is empty\n", path);
+        close(fd);
+        return;
+    }
+    const char *data = (const char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror("Failed to map clearing file");
+        return;
+    }
+    madvise((void *)data, size, MADV_SEQUENTIAL);
+    FILE *rejectFile = fopen(rejectPath, "w");
+    if (!rejectFile) {
+        perror("Failed to create reject file");
+        munmap((void *)data, size);
+        return;
+    }
+
+    int partitions = partitionCount(size, INGEST_MIN_PARTITION * (INGEST_RECORD_WIDTH + 1), INGEST_MAX_THREADS);
+    IngestPartition parts[INGEST_MAX_THREADS];
+    pthread_t threads[INGEST_MAX_THREADS];
+    const char *begins[INGEST_MAX_THREADS];
+    const char *ends[INGEST_MAX_THREADS];
+    memset(parts, 0, sizeof(parts));
+    splitAtLines(data, size, partitions, begins, ends);
+    for (int i = 0; i < partitions; i++) {
+        parts[i].data = data;
+        parts[i].begin = begins[i];
+        parts[i].end = ends[i];
+    }
+    int started = 0;
+    for (int i = 1; i < partitions; i++, started++) {
+        if (pthread_create(&threads[i], NULL, ingestParser, &parts[i]) != 0) {
+            break;
+        }
+    }
+    for (int i = started + 1; i < partitions; i++) {
+        ingestParser(&parts[i]);
+    }
+    ingestParser(&parts[0]);
+    for (int i = 1; i <= started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    // Concatenate the valid records of all partitions and group them by account
+    size_t valid = 0;
+    size_t formatRejects = 0;
+    long long records = 0;
+    int failed = 0;
+    for (int i = 0; i < partitions; i++) {
+        valid += parts[i].valid;
+        formatRejects += parts[i].rejectCount;
+        records += parts[i].lines;
+        failed |= parts[i].failed;
+    }
+    TransactionRequest *requests = (TransactionRequest *)malloc((valid ? valid : 1) * sizeof(TransactionRequest));
+    if (!requests) {
+        perror("Failed to allocate memory for ingestion");
+        for (int i = 0; i < partitions; i++) {
+            free(parts[i].requests);
+            free(parts[i].rejects);
+        }
+        fclose(rejectFile);
+        munmap((void *)data, size);
+        return;
+    }
+    valid = 0;
+    for (int i = 0; i < partitions; i++) {
+        memcpy(requests + valid, parts[i].requests, parts[i].valid * sizeof(TransactionRequest));
+        valid += parts[i].valid;
+        free(parts[i].requests);
+    }
+    long long parsedTime = monotonicNanos();
+    fprintf(bankOut, "Parsed %lld record(s) with %d thread(s) in %.3f s (%.1f MB/s): %zu valid, %zu malformed\n",
+            records, partitions, (parsedTime - startTime) / 1e9, size / 1e6 / ((parsedTime - startTime) / 1e9 + 1e-9), valid, formatRejects);
+    qsort(requests, valid, sizeof(TransactionRequest), compareTransactionRequests);
+
+    pthread_mutex_lock(&bankLock);
+    size_t applied = applyTransactionBatch(requests, valid);
+    pthread_mutex_unlock(&bankLock);
+    long long appliedTime = monotonicNanos();
+    fprintf(bankOut, "Posted %zu of %zu transaction(s) in %.3f s (%.0f transactions/s)\n",
+            applied, valid, (appliedTime - parsedTime) / 1e9, valid / ((appliedTime - parsedTime) / 1e9 + 1e-9));
+
+    // Collect every reject in file order and write them out
+    size_t rejectCount = formatRejects + (valid - applied);
+    IngestReject *rejects = (IngestReject *)malloc((rejectCount ? rejectCount : 1) * sizeof(IngestReject));
+    if (rejects) {
+        size_t n = 0;
+        for (int i = 0; i < partitions; i++) {
+            memcpy(rejects + n, parts[i].rejects, parts[i].rejectCount * sizeof(IngestReject));
+            n += parts[i].rejectCount;
+        }
+        for (size_t i = 0; i < valid; i++) {
+            if (requests[i].result != TRANSACTION_OK) {
+                rejects[n].offset = requests[i].tag;
+                rejects[n].reason = transactionResultText(requests[i].result, requests[i].accountType);
+                n++;
+            }
+        }
+        qsort(rejects, n, sizeof(IngestReject), compareIngestRejects);
+        for (size_t i = 0; i < n; i++) {
+            ingestWriteReject(rejectFile, data, size, rejects[i].offset, rejects[i].reason);
+        }
+        free(rejects);
+    } else {
+        failed = 1;
+    }
+    for (int i = 0; i < partitions; i++) {
+        free(parts[i].rejects);
+    }
+    if (fclose(rejectFile) != 0) {
+        perror("Failed to write reject file");
+    }
+    double seconds = (monotonicNanos() - startTime) / 1e9;
+    fprintf(bankOut, "Ingested %s: %zu posted, %zu rejected to %s, %.3f s total (%.0f records/s)\n",
+            path, applied, rejectCount, rejectPath, seconds, records / (seconds + 1e-9));
+    if (failed) {
+        fprintf(bankOut, "Warning: ran out of memory; some rejects were not written\n");
+    }
+    free(requests);
+    munmap((void *)data, size);
+}
+
+// Prints the operational counters (STATS command).
+void printStats(void) {
+    long long rowLookups = bankStats.rowCacheHits + bankStats.rowCacheMisses;
+    fprintf(bankOut, "Accounts: %lld\n", bankStats.accounts);
+    fprintf(bankOut, "Report row cache: %lld hit(s), %lld miss(es), hit rate %.1f%%\n",
+            bankStats.rowCacheHits, bankStats.rowCacheMisses,
+            rowLookups ? 100.0 * bankStats.rowCacheHits / rowLookups : 0.0);
+    fprintf(bankOut, "Deleted blocks awaiting reclamation: %lld (%lld bytes), reclaimed: %lld\n",
+            bankStats.retiredNodes, bankStats.retiredBytes, bankStats.reclaimedNodes);
+    printPool("Account arena", &accountPool);
+    printPool("Name arena", &namePool);
+    fprintf(bankOut, "Interned names: %zu distinct, shared by %lld account(s)\n", nameCount, nameRefs);
+    printPool("Index arena", &indexPool);
+    fprintf(bankOut, "Packed records: %u slot(s), %zu bytes; packed names: %u bytes (%u garbage)\n",
+            packedHighWater, (size_t)packedCapacity * sizeof(PackedAccount), packedNames.used, packedNames.garbage);
+    fprintf(bankOut, "Name dictionary: %u name(s) in %u block(s), %u bytes\n",
+            packedDict.count, packedDict.blockCount, packedDict.size);
+    if (loanBook.count > 0) {
+        int64_t outstanding;
+        size_t open = loansOutstanding(&outstanding);
+        fprintf(bankOut, "Loans: %zu granted, %zu outstanding, Rs %.2f principal\n", loanBook.count, open, outstanding / 100.0);
+    }
+    if (coldFd >= 0) {
+        fprintf(bankOut, "Cold tier: %lld account(s) evicted, %lld eviction(s), %lld fault(s); %u record(s) in %u page(s), %u free\n",
+                bankStats.coldAccounts, bankStats.coldEvictions, bankStats.coldFaults, coldRecordCount,
+                (uint32_t)((coldRecordCount + COLD_RECORDS_PER_PAGE - 1) / COLD_RECORDS_PER_PAGE), coldFreeCount);
+    }
+}
+
+// Converts an account type string ("savings"/"current") to the enum.
+// Returns 1 on success, 0 if the string is not a known account type.
+int parseAccountType(const char *str, AccountType *accountType) {
+    for (int type = 0; type < ACCOUNT_TYPE_COUNT; type++) {
+        if (strcmp(str, accountPolicies[type].name) == 0) {
+            *accountType = (AccountType)type;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Stackless coroutine (protothread style).
+// The resume point is the source line of the last yield, so resuming is a single
+// switch jump. Locals do not survive a yield: anything needed afterwards must live
+// in the structure that owns the coroutine.
+typedef struct Coroutine {
+    int resumeLine; // 0 = not started, otherwise the line to continue from
+} Coroutine;
+
+#define CORO_BEGIN(co) switch ((co)->resumeLine) { case 0:
+#define CORO_YIELD(co, value) do { (co)->resumeLine = __LINE__; return (value); case __LINE__:; } while (0)
+#define CORO_END(co, value) } (co)->resumeLine = -1; return (value)
+
+// Result of resuming a session.
+typedef enum SessionStatus {
+    SESSION_NEEDS_INPUT, // Waiting for the next input token
+    SESSION_FINISHED     // The client issued EXIT
+} SessionStatus;
+
+// State of one client session.
+// The command dialog is written sequentially in sessionResume(); these fields
+// hold everything that has to survive between two input tokens.
+typedef struct Session {
+    Coroutine co;                   // Where the dialog continues on the next token
+    const char *token;              // Token supplied to the current resume (NULL on the first one)
+    unsigned id;                    // Identifies the session in recordings (0 = console)
+    long long commandsCompleted;    // Number of times the dialog returned to the command prompt
+    char commandInput[100];         // Buffer for user command
+    char accountTypeInputStr[20];   // Buffer for account type string ("savings"/"current")
+    AccountType accType;            // Variable for AccountType enum
+    float amountInput;              // Buffer for transaction/deposit amount
+    char nameInput[50];             // Buffer for account holder's name (max 49 chars + null terminator)
+    int targetAccountNumberInput;   // Buffer for account number in transactions
+    int transactionCodeInput;       // Buffer for transaction code (0 for withdrawal, 1 for deposit)
+    char pathInput[100];            // Buffer for a file name (SNAPSHOT, EXPORT, DIFF, RECONCILE, INGEST)
+    char secondPathInput[100];      // Buffer for a second file name (INGEST reject file)
+    double rateInput;               // Buffer for an annual interest rate (LOAN)
+    int monthsInput;                // Buffer for a loan term in months (LOAN)
+} Session;
+
+// Suspends the session until the next token arrives, then stores it in 'buf' (an array).
+#define SESSION_READ(s, buf) do { \
+        CORO_YIELD(&(s)->co, SESSION_NEEDS_INPUT); \
+        copyToken((buf), sizeof(buf), (s)->token); \
+    } while (0)
+
+// Body of sessionResume(): the command dialog itself.
+SessionStatus sessionRun(Session *s, const char *token) {
+    char numberInput[32]; // Scratch buffer for numeric tokens, only used between two yields
+    s->token = token;
+
+    CORO_BEGIN(&s->co);
+    fprintf(bankOut, "Bank Management System (q1.c enhanced)\n");
+    fprintf(bankOut, "Commands: CREATE, DELETE, DISPLAY, TRANSACTION, BALANCE, LOWBALANCE, FINGERPRINT, SNAPSHOT, EXPORT, DIFF, RECONCILE, INGEST, DORMANT, ACCRUE, LOAN, EMI, EVICT, STATS, EXIT\n");
+
+    // Main command loop
+    while (1) {
+        s->commandsCompleted++;
+        fprintf(bankOut, "\nEnter command: ");
+        SESSION_READ(s, s->commandInput); // Read the command
+        coldMaybeSweep(); // Evict idle accounts now and then
+
+        // Exit command
+        if (strcmp(s->commandInput, "EXIT") == 0) {
+            fprintf(bankOut, "Exiting program. Goodbye!\n");
+            break; // Exit the loop and end the session
+        }
+        // Create account command
+        else if (strcmp(s->commandInput, "CREATE") == 0) {
+            fprintf(bankOut, "Enter account type (%s): ", accountTypeChoices);
+            SESSION_READ(s, s->accountTypeInputStr);
+            fprintf(bankOut, "Enter account holder's name: ");
+            SESSION_READ(s, s->nameInput); // Names longer than 49 characters are truncated
+            fprintf(bankOut, "Enter initial deposit amount: ");
+            SESSION_READ(s, numberInput);
+            s->amountInput = strtof(numberInput, NULL);
+
+            // Convert account type string to enum
+            if (!parseAccountType(s->accountTypeInputStr, &s->accType)) {
+                fprintf(bankOut, "Invalid Account Type: '%s'. Please use one of %s.\n", s->accountTypeInputStr, accountTypeList);
+                continue; // Go to the next iteration of the loop
+            }
+
+            pthread_mutex_lock(&bankLock);
+            // Check for duplicate account before creating; the interned name knows its accounts
+            if (nameAccount(s->nameInput, s->accType) != 0) {
+                fprintf(bankOut, "Invalid: Account for '%s' of type '%s' already exists.\n", s->nameInput, s->accountTypeInputStr);
+            } else {
+                // Sort deleted numbers list to ensure the smallest is used first for recycling
+                deletedAccountNumbersHead = sortDeletedAccountNumList(deletedAccountNumbersHead);
+                accountsHead = createAccount(&deletedAccountNumbersHead, accountsHead, s->accType, s->nameInput, s->amountInput);
+            }
+            pthread_mutex_unlock(&bankLock);
+        }
+        // Delete account command
+        else if (strcmp(s->commandInput, "DELETE") == 0) {
+            fprintf(bankOut, "Enter account type to delete (%s): ", accountTypeChoices);
+            SESSION_READ(s, s->accountTypeInputStr);
+            fprintf(bankOut, "Enter account holder's name to delete: ");
+            SESSION_READ(s, s->nameInput);
+
+            // Convert account type string to enum
+            if (!parseAccountType(s->accountTypeInputStr, &s->accType)) {
+                fprintf(bankOut, "Invalid Account Type: '%s'. Please use one of %s.\n", s->accountTypeInputStr, accountTypeList);
+                continue; // Go to the next iteration of the loop
+            }
+
+            pthread_mutex_lock(&bankLock);
+            int deletedNum = -1; // To store the account number of the deleted account
+            accountsHead = deleteAccount(accountsHead, s->accType, s->nameInput, &deletedNum);
+            if (deletedNum != -1) { // If an account was successfully deleted
+                deletedAccountNumbersHead = addDeletedAccountNum(deletedAccountNumbersHead, deletedNum);
+                // Success message is printed inside deleteAccount
+            }
+            // "Account does not exist" message is also printed inside deleteAccount
+            pthread_mutex_unlock(&bankLock);
+        }
+        // Display all accounts command
+        else if (strcmp(s->commandInput, "DISPLAY") == 0) {
+            pthread_mutex_lock(&bankLock);
+            AccountCursor cursor = bookAccounts(); // Walk the accounts in number order
+            displayAccounts(&cursor);
+            pthread_mutex_unlock(&bankLock);
+        }
+        // Display low balance accounts command
+        else if (strcmp(s->commandInput, "LOWBALANCE") == 0) {
+            pthread_mutex_lock(&bankLock);
+            AccountCursor cursor = lowBalanceCandidates(); // Already in number order
+            lowBalanceAccountsIn(&cursor);
+            pthread_mutex_unlock(&bankLock);
+        }
+        // Transaction command
+        else if (strcmp(s->commandInput, "TRANSACTION") == 0) {
+            fprintf(bankOut, "Enter account number for transaction: ");
+            SESSION_READ(s, numberInput);
+            s->targetAccountNumberInput = atoi(numberInput);
+            fprintf(bankOut, "Enter amount: ");
+            SESSION_READ(s, numberInput);
+            s->amountInput = strtof(numberInput, NULL);
+            fprintf(bankOut, "Enter transaction code (1 for deposit, 0 for withdrawal): ");
+            SESSION_READ(s, numberInput);
+            s->transactionCodeInput = atoi(numberInput);
+
+            pthread_mutex_lock(&bankLock);
+            accountsHead = transaction(accountsHead, s->targetAccountNumberInput, s->amountInput, s->transactionCodeInput);
+            pthread_mutex_unlock(&bankLock);
+        }
+        // Balance inquiry command: lock-free, see readBalance()
+        else if (strcmp(s->commandInput, "BALANCE") == 0) {
+            fprintf(bankOut, "Enter account number: ");
+            SESSION_READ(s, numberInput);
+            s->targetAccountNumberInput = atoi(numberInput);
+
+            float balance;
+            if (readBalance(s->targetAccountNumberInput, &balance)) {
+                fprintf(bankOut, "Balance of account %d is Rs.%.2f\n", s->targetAccountNumberInput, balance);
+            } else {
+                fprintf(bankOut, "Invalid: Account with number %d does not exist\n", s->targetAccountNumberInput);
+            }
+        }
+        // State fingerprint command
+        else if (strcmp(s->commandInput, "FINGERPRINT") == 0) {
+            pthread_mutex_lock(&bankLock);
+            fprintf(bankOut, "State fingerprint: %016llx\n", (unsigned long long)stateHash());
+            pthread_mutex_unlock(&bankLock);
+        }
+        // Snapshot command
+        else if (strcmp(s->commandInput, "SNAPSHOT") == 0) {
+            fprintf(bankOut, "Enter snapshot file name: ");
+            SESSION_READ(s, s->pathInput);
+            pthread_mutex_lock(&bankLock);
+            if (snapshotWrite(s->pathInput)) {
+                fprintf(bankOut, "Snapshot written to %s (fingerprint %016llx)\n", s->pathInput, (unsigned long long)stateHash());
+            }
+            pthread_mutex_unlock(&bankLock);
+        }
+        // Loan command: grant a loan linked to a current account
+        else if (strcmp(s->commandInput, "LOAN") == 0) {
+            fprintf(bankOut, "Enter current account number: ");
+            SESSION_READ(s, numberInput);
+            s->targetAccountNumberInput = atoi(numberInput);
+            fprintf(bankOut, "Enter loan amount: ");
+            SESSION_READ(s, numberInput);
+            s->amountInput = strtof(numberInput, NULL);
+            fprintf(bankOut, "Enter annual interest rate (%%): ");
+            SESSION_READ(s, numberInput);
+            s->rateInput = atof(numberInput);
+            fprintf(bankOut, "Enter number of months: ");
+            SESSION_READ(s, numberInput);
+            s->monthsInput = atoi(numberInput);
+
+            pthread_mutex_lock(&bankLock);
+            createLoan(s->targetAccountNumberInput, s->amountInput, s->rateInput, s->monthsInput);
+            pthread_mutex_unlock(&bankLock);
+        }
+        // Month-end installment command
+        else if (strcmp(s->commandInput, "EMI") == 0) {
+            pthread_mutex_lock(&bankLock);
+            postInstallments();
+            pthread_mutex_unlock(&bankLock);
+        }
+        // Interest accrual command
+        else if (strcmp(s->commandInput, "ACCRUE") == 0) {
+            pthread_mutex_lock(&bankLock);
+            accrueInterest();
+            pthread_mutex_unlock(&bankLock);
+        }
+        // Dormancy report command
+        else if (strcmp(s->commandInput, "DORMANT") == 0) {
+            fprintf(bankOut, "Enter number of days without activity: ");
+            SESSION_READ(s, numberInput);
+            pthread_mutex_lock(&bankLock);
+            dormantAccounts(atoi(numberInput));
+            pthread_mutex_unlock(&bankLock);
+        }
+        // Eviction command: sweep idle accounts to the cold tier now
+        else if (strcmp(s->commandInput, "EVICT") == 0) {
+            pthread_mutex_lock(&bankLock);
+            if (coldFd < 0) {
+                fprintf(bankOut, "No cold store: start with --cold-store <file>\n");
+            } else {
+                long long evicted = coldSweep();
+                fprintf(bankOut, "Evicted %lld idle account(s); %lld account(s) are cold\n", evicted, bankStats.coldAccounts);
+            }
+            pthread_mutex_unlock(&bankLock);
+        }
+        // Name-ordered export command
+        else if (strcmp(s->commandInput, "EXPORT") == 0) {
+            fprintf(bankOut, "Enter export file name: ");
+            SESSION_READ(s, s->pathInput);
+            pthread_mutex_lock(&bankLock);
+            long long written = exportByName(s->pathInput);
+            if (written >= 0) {
+                fprintf(bankOut, "Exported %lld account(s) in name order to %s\n", written, s->pathInput);
+            }
+            pthread_mutex_unlock(&bankLock);
+        }
+        // Audit diff command
+        else if (strcmp(s->commandInput, "DIFF") == 0) {
+            fprintf(bankOut, "Enter snapshot file (or shm:<name>) to compare with: ");
+            SESSION_READ(s, s->pathInput);
+            diffLiveBook(s->pathInput);
+        }
+        // Reconciliation command
+        else if (strcmp(s->commandInput, "RECONCILE") == 0) {
+            fprintf(bankOut, "Enter statement file name: ");
+            SESSION_READ(s, s->pathInput);
+            pthread_mutex_lock(&bankLock);
+            reconcile(s->pathInput);
+            pthread_mutex_unlock(&bankLock);
+        }
+        // Clearing file ingestion command
+        else if (strcmp(s->commandInput, "INGEST") == 0) {
+            fprintf(bankOut, "Enter clearing file name: ");
+            SESSION_READ(s, s->pathInput);
+            fprintf(bankOut, "Enter reject file name: ");
+            SESSION_READ(s, s->secondPathInput);
+            ingest(s->pathInput, s->secondPathInput);
+        }
+        // Statistics command
+        else if (strcmp(s->commandInput, "STATS") == 0) {
+            pthread_mutex_lock(&bankLock);
+            printStats();
+            pthread_mutex_unlock(&bankLock);
         }
         // Invalid command
         else {
-            printf("Invalid command: '%s'. Please use CREATE, DELETE, DISPLAY, TRANSACTION, LOWBALANCE, or EXIT.\n", commandInput);
+            fprintf(bankOut, "Invalid command: '%s'. Please use CREATE, DELETE, DISPLAY, TRANSACTION, BALANCE, LOWBALANCE, FINGERPRINT, SNAPSHOT, EXPORT, DIFF, RECONCILE, INGEST, DORMANT, ACCRUE, LOAN, EMI, EVICT, STATS, or EXIT.\n", s->commandInput);
+        }
+    }
+
+    CORO_END(&s->co, SESSION_FINISHED);
+}
+
+// Runs a session until it needs another input token or finishes.
+// Pass token = NULL on the first call to print the banner and the first prompt.
+SessionStatus sessionResume(Session *s, const char *token) {
+    if (recordFile == NULL || token == NULL) {
+        return sessionRun(s, token);
+    }
+    // While recording, tokens are logged and executed under one lock so that the
+    // recording holds them in the order their commands really ran
+    pthread_mutex_lock(&recordLock);
+    recordToken(s->id, token);
+    SessionStatus status = sessionRun(s, token);
+    pthread_mutex_unlock(&recordLock);
+    return status;
+}
+
+// A client connection in server mode: its socket, its session and its I/O buffers.
+typedef struct Connection {
+    int fd;                 // Client socket (non-blocking)
+    Session session;        // Command dialog of this client
+    char inBuf[128];        // Received bytes not yet consumed as complete tokens
+    size_t inLen;           // Number of bytes in inBuf
+    FILE *out;              // Memory stream the session writes its output to
+    char *outBuf;           // Buffer behind 'out' (owned by the stream)
+    size_t outSize;         // Size reported by the stream
+    size_t outSent;         // Bytes of the current output already sent
+    int finished;           // Session has ended; close once the output is sent
+} Connection;
+
+// Settings shared by all server worker threads.
+typedef struct ServerConfig {
+    int listenFd;           // Listening socket shared by all workers
+    int wakeFd;             // Read end of a pipe that becomes readable when the server stops
+    int stopping;           // Set once at shutdown; workers close their sessions and return
+} ServerConfig;
+
+// Feeds every complete whitespace-terminated token in the connection's input buffer to its session.
+void connectionConsumeInput(Connection *c) {
+    size_t start = 0;
+    size_t i = 0;
+    while (i < c->inLen && !c->finished) {
+        char ch = c->inBuf[i];
+        if (ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r') {
+            if (i > start) {
+                c->inBuf[i] = '\0';
+                if (sessionResume(&c->session, c->inBuf + start) == SESSION_FINISHED) {
+                    c->finished = 1;
+                }
+            }
+            start = i + 1;
+        }
+        i++;
+    }
+    if (c->finished) {
+        c->inLen = 0;
+        return;
+    }
+    // Keep the partial token; a token that fills the whole buffer is passed on truncated
+    if (start == 0 && c->inLen == sizeof(c->inBuf)) {
+        c->inBuf[sizeof(c->inBuf) - 1] = '\0';
+        if (sessionResume(&c->session, c->inBuf) == SESSION_FINISHED) {
+            c->finished = 1;
+        }
+        c->inLen = 0;
+        return;
+    }
+    memmove(c->inBuf, c->inBuf + start, c->inLen - start);
+    c->inLen -= start;
+}
+
+// Sends as much pending output as the socket accepts.
+// Returns 0 on success, -1 if the connection failed.
+int connectionFlush(Connection *c) {
+    fflush(c->out);
+    size_t produced = (size_t)ftell(c->out);
+    while (c->outSent < produced) {
+        ssize_t n = send(c->fd, c->outBuf + c->outSent, produced - c->outSent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0; // Wait until the socket is writable again
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        c->outSent += (size_t)n;
+    }
+    rewind(c->out); // Everything went out; reuse the buffer from the start
+    c->outSent = 0;
+    return 0;
+}
+
+// Returns 1 if the connection still has output waiting to be sent.
+int connectionHasPendingOutput(Connection *c) {
+    return c->outSent < (size_t)ftell(c->out);
+}
+
+// Session ids for server connections; 0 is the console session.
+unsigned nextSessionId = 1;
+
+// Accepts a new client and starts its session.
+// Returns NULL if no client was waiting or the connection could not be set up.
+Connection *connectionAccept(int listenFd) {
+    int fd = accept(listenFd, NULL, NULL);
+    if (fd < 0) {
+        return NULL; // Another worker took it, or nothing to accept
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    Connection *c = (Connection *)calloc(1, sizeof(Connection));
+    if (!c) {
+        perror("Failed to allocate memory for connection");
+        close(fd);
+        return NULL;
+    }
+    c->fd = fd;
+    c->session.id = __atomic_fetch_add(&nextSessionId, 1, __ATOMIC_RELAXED);
+    c->out = open_memstream(&c->outBuf, &c->outSize);
+    if (!c->out) {
+        perror("Failed to create connection output stream");
+        free(c);
+        close(fd);
+        return NULL;
+    }
+    bankOut = c->out;
+    sessionResume(&c->session, NULL); // Banner and first prompt
+    return c;
+}
+
+// Closes a client connection and releases its buffers.
+void connectionClose(Connection *c) {
+    close(c->fd);
+    fclose(c->out);
+    free(c->outBuf);
+    free(c);
+}
+
+// Worker thread of the server: multiplexes its share of the client sessions with poll().
+void *serverWorker(void *arg) {
+    ServerConfig *config = (ServerConfig *)arg;
+    Connection **conns = NULL;   // Sessions owned by this worker
+    struct pollfd *fds = NULL;   // fds[0] is the listener, fds[1] the wake pipe, fds[i + 2] belongs to conns[i]
+    size_t count = 0;
+    size_t capacity = 0;
+
+    while (!__atomic_load_n(&config->stopping, __ATOMIC_ACQUIRE)) {
+        if (count + 1 > capacity) {
+            size_t newCapacity = capacity ? capacity * 2 : 64;
+            Connection **newConns = (Connection **)realloc(conns, newCapacity * sizeof(Connection *));
+            struct pollfd *newFds = newConns ? (struct pollfd *)realloc(fds, (newCapacity + 2) * sizeof(struct pollfd)) : NULL;
+            if (newConns) {
+                conns = newConns;
+            }
+            if (!newFds) {
+                perror("Failed to grow the server connection table");
+                sleep(1);
+                continue;
+            }
+            fds = newFds;
+            capacity = newCapacity;
+        }
+
+        fds[0].fd = config->listenFd;
+        fds[0].events = POLLIN;
+        fds[1].fd = config->wakeFd;
+        fds[1].events = POLLIN;
+        for (size_t i = 0; i < count; i++) {
+            fds[i + 2].fd = conns[i]->fd;
+            // Stop reading from a client until its earlier output has been sent
+            fds[i + 2].events = connectionHasPendingOutput(conns[i]) ? POLLOUT : POLLIN;
+            fds[i + 2].revents = 0;
+        }
+        if (poll(fds, count + 2, -1) < 0) {
+            if (errno != EINTR) {
+                perror("poll");
+            }
+            continue;
+        }
+        if (fds[1].revents) {
+            break; // The pipe is never drained, so it wakes every worker
+        }
+
+        if (fds[0].revents & POLLIN) {
+            Connection *c = connectionAccept(config->listenFd);
+            if (c) {
+                if (connectionFlush(c) < 0) {
+                    connectionClose(c);
+                } else {
+                    conns[count++] = c;
+                }
+            }
+        }
+
+        // Walk backwards so closed connections can be removed by swapping in the last one
+        for (size_t i = count; i-- > 0;) {
+            Connection *c = conns[i];
+            short revents = fds[i + 2].revents;
+            int failed = 0;
+            if (revents & (POLLIN | POLLHUP | POLLERR)) {
+                ssize_t n = recv(c->fd, c->inBuf + c->inLen, sizeof(c->inBuf) - c->inLen, 0);
+                if (n > 0) {
+                    c->inLen += (size_t)n;
+                    bankOut = c->out;
+                    connectionConsumeInput(c);
+                } else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                    failed = 1; // Client went away
+                }
+            }
+            if (!failed && (revents & (POLLIN | POLLOUT))) {
+                failed = connectionFlush(c) < 0;
+            }
+            if (failed || (c->finished && !connectionHasPendingOutput(c))) {
+                connectionClose(c);
+                conns[i] = conns[--count];
+            }
+        }
+    }
+
+    // Commands only run inside this loop, so once it is left no session touches the book
+    for (size_t i = 0; i < count; i++) {
+        connectionFlush(conns[i]); // Best effort; the client may not be reading
+        connectionClose(conns[i]);
+    }
+    free(conns);
+    free(fds);
+    reportBufferFree();
+    return NULL;
+}
+
+// Serves the bank over TCP: every client connection runs its own session.
+// Sessions are spread over 'threads' worker threads, each multiplexing many of them.
+// Runs until SIGINT or SIGTERM, then stops and joins the workers and closes the recording.
+// The caller still owns the book, the log and the replica and releases them afterwards.
+// Returns the process exit status.
+int serve(int port, int threads) {
+    int listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenFd < 0) {
+        perror("socket");
+        return 1;
+    }
+    int reuse = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons((unsigned short)port);
+    if (bind(listenFd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listenFd, SOMAXCONN) < 0) {
+        perror("Failed to listen");
+        close(listenFd);
+        return 1;
+    }
+    // Non-blocking so that workers racing for the same client do not block in accept()
+    fcntl(listenFd, F_SETFL, fcntl(listenFd, F_GETFL) | O_NONBLOCK);
+
+    // Workers inherit a mask with the shutdown signals blocked; only this thread takes them
+    sigset_t shutdownSignals;
+    sigemptyset(&shutdownSignals);
+    sigaddset(&shutdownSignals, SIGINT);
+    sigaddset(&shutdownSignals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &shutdownSignals, NULL);
+
+    int wake[2];
+    pthread_t *workers = (pthread_t *)malloc((size_t)threads * sizeof(pthread_t));
+    if (!workers || pipe(wake) < 0) {
+        perror("Failed to set up the server workers");
+        free(workers);
+        close(listenFd);
+        return 1;
+    }
+    ServerConfig config = { listenFd, wake[0], 0 };
+    printf("Serving on port %d with %d worker thread(s)\n", port, threads);
+    fflush(stdout);
+    int started = 0;
+    while (started < threads && pthread_create(&workers[started], NULL, serverWorker, &config) == 0) {
+        started++;
+    }
+    if (started < threads) {
+        fprintf(stderr, "Failed to start worker thread %d\n", started);
+    }
+
+    int status = 0;
+    if (started > 0) {
+        int sig;
+        sigwait(&shutdownSignals, &sig);
+        printf("Shutting down\n");
+    } else {
+        status = 1;
+    }
+    // Workers finish the command they are running, close their sessions and exit
+    __atomic_store_n(&config.stopping, 1, __ATOMIC_RELEASE);
+    if (write(wake[1], "", 1) < 0) {
+        perror("Failed to wake the server workers");
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+    close(wake[0]);
+    close(wake[1]);
+    close(listenFd);
+    recordClose();
+    return status;
+}
+
+// Reporting process: runs a DISPLAY or LOWBALANCE query against the shared-memory
+// replica published by a running bank process, without locking it.
+// Returns the process exit status.
+int replicaReport(const char *name, const char *query) {
+    uint32_t count;
+    ReplicaRecord *copies = replicaLoad(name, &count);
+    if (copies == NULL) {
+        return 1;
+    }
+    AccountNode *nodes = (AccountNode *)calloc(count ? count : 1, sizeof(AccountNode));
+    if (!nodes) {
+        perror("Failed to allocate memory for replica report");
+        free(copies);
+        return 1;
+    }
+    // Slots are already in account number order
+    AccountList list = NULL;
+    AccountNode **tail = &list;
+    for (uint32_t i = 0; i < count; i++) {
+        if (copies[i].accountNumber == 0) {
+            continue;
+        }
+        AccountNode *node = &nodes[i];
+        node->AccountNumber = copies[i].accountNumber;
+        node->Name = copies[i].name;
+        node->accountType = (AccountType)copies[i].accountType;
+        node->Amount = copies[i].amount;
+        node->next = NULL;
+        *tail = node;
+        tail = &node->next;
+    }
+
+    int status = 0;
+    if (strcmp(query, "DISPLAY") == 0) {
+        display(list);
+    } else if (strcmp(query, "LOWBALANCE") == 0) {
+        lowBalanceAccounts(list);
+    } else {
+        fprintf(stderr, "Invalid report query: '%s'. Please use DISPLAY or LOWBALANCE.\n", query);
+        status = 1;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        free(nodes[i].displayRow);
+    }
+    free(nodes);
+    free(copies);
+    return status;
+}
+
+// One token of a recording.
+typedef struct ReplayToken {
+    long long time;         // Microseconds after the start of the recording
+    unsigned sessionId;     // Session the token was typed into; renumbered densely before the replay
+    char text[100];         // The token itself
+} ReplayToken;
+
+// Compares two session ids for qsort() and bsearch().
+int compareSessionIds(const void *a, const void *b) {
+    unsigned x = *(const unsigned *)a;
+    unsigned y = *(const unsigned *)b;
+    return (x > y) - (x < y);
+}
+
+// Compares two latencies for qsort().
+int compareLongLong(const void *a, const void *b) {
+    long long x = *(const long long *)a;
+    long long y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+// Replays a recording made with --record against this process's book.
+// With 'paced' set tokens are issued at their recorded times, otherwise as fast as possible.
+// Prints throughput and per-command latency, then compares the final state hash with the
+// recorded one. Returns the process exit status (1 on a mismatch).
+int replay(const char *path, int paced) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        perror("Failed to open recording");
+        return 1;
+    }
+    ReplayToken *tokens = NULL;
+    size_t count = 0, capacity = 0;
+    unsigned long long startHash = 0, endHash = 0;
+    int haveStart = 0, haveEnd = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+        if (sscanf(line, "# start %llx", &startHash) == 1) {
+            haveStart = 1;
+            continue;
+        }
+        if (sscanf(line, "# end %llx", &endHash) == 1) {
+            haveEnd = 1;
+            continue;
+        }
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 1024;
+            ReplayToken *grown = (ReplayToken *)realloc(tokens, capacity * sizeof(ReplayToken));
+            if (!grown) {
+                perror("Failed to allocate memory for recording");
+                free(tokens);
+                fclose(file);
+                return 1;
+            }
+            tokens = grown;
+        }
+        ReplayToken *t = &tokens[count];
+        if (sscanf(line, "%lld %u %99s", &t->time, &t->sessionId, t->text) == 3) {
+            count++;
+        }
+    }
+    fclose(file);
+
+    if (haveStart && startHash != stateHash()) {
+        fprintf(stderr, "Warning: the book does not start in the recorded state (%016llx, recorded %016llx)\n",
+                (unsigned long long)stateHash(), startHash);
+    }
+
+    // Server session ids only ever count up, so the recorded ids can be large and sparse.
+    // Renumber them by rank so that the sessions fit a table of one entry per distinct id.
+    unsigned *ids = (unsigned *)malloc((count ? count : 1) * sizeof(unsigned));
+    size_t sessionCount = 0;
+    if (ids != NULL) {
+        for (size_t i = 0; i < count; i++) {
+            ids[i] = tokens[i].sessionId;
+        }
+        qsort(ids, count, sizeof(unsigned), compareSessionIds);
+        for (size_t i = 0; i < count; i++) {
+            if (sessionCount == 0 || ids[sessionCount - 1] != ids[i]) {
+                ids[sessionCount++] = ids[i];
+            }
+        }
+        for (size_t i = 0; i < count; i++) {
+            unsigned *rank = (unsigned *)bsearch(&tokens[i].sessionId, ids, sessionCount, sizeof(unsigned), compareSessionIds);
+            tokens[i].sessionId = (unsigned)(rank - ids);
+        }
+    }
+
+    // Command output is not part of the measurement
+    FILE *sink = fopen("/dev/null", "w");
+    Session *sessions = (Session *)calloc(sessionCount ? sessionCount : 1, sizeof(Session));
+    long long *latencies = (long long *)malloc((count ? count : 1) * sizeof(long long));
+    if (!ids || !sink || !sessions || !latencies) {
+        perror("Failed to set up replay");
+        if (sink) {
+            fclose(sink);
+        }
+        free(ids);
+        free(sessions);
+        free(latencies);
+        free(tokens);
+        return 1;
+    }
+    free(ids);
+    bankOut = sink;
+
+    size_t commands = 0;
+    long long begin = monotonicNanos();
+    for (size_t i = 0; i < count; i++) {
+        Session *s = &sessions[tokens[i].sessionId];
+        if (paced) {
+            long long target = begin + tokens[i].time * 1000;
+            struct timespec ts = { (time_t)(target / 1000000000LL), (long)(target % 1000000000LL) };
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        }
+        if (s->co.resumeLine == 0) {
+            sessionResume(s, NULL); // Banner and first prompt, as when the client connected
+        }
+        if (s->co.resumeLine < 0) {
+            continue; // The session already exited
+        }
+        long long before = s->commandsCompleted;
+        long long t0 = monotonicNanos();
+        sessionResume(s, tokens[i].text);
+        long long t1 = monotonicNanos();
+        if (s->commandsCompleted != before) {
+            latencies[commands++] = t1 - t0;
+        }
+    }
+    long long elapsed = monotonicNanos() - begin;
+    bankOut = stdout;
+    fclose(sink);
+
+    printf("Replayed %zu token(s), %zu command(s) from %zu session(s) in %.3f s%s\n",
+           count, commands, sessionCount, elapsed / 1e9, paced ? " (original pacing)" : "");
+    if (commands > 0) {
+        qsort(latencies, commands, sizeof(long long), compareLongLong);
+        printf("Throughput: %.0f commands/s\n", commands / (elapsed / 1e9));
+        printf("Command latency: p50 %.2f us, p90 %.2f us, p99 %.2f us, max %.2f us\n",
+               latencies[commands / 2] / 1000.0, latencies[commands * 9 / 10] / 1000.0,
+               latencies[commands * 99 / 100] / 1000.0, latencies[commands - 1] / 1000.0);
+    }
+
+    int status = 0;
+    unsigned long long finalHash = stateHash();
+    if (!haveEnd) {
+        printf("Final state hash %016llx (recording has no final hash to compare with)\n", finalHash);
+    } else if (finalHash == endHash) {
+        printf("Final state hash %016llx matches the recording\n", finalHash);
+    } else {
+        printf("Final state hash %016llx does NOT match the recording (%016llx)\n", finalHash, endHash);
+        status = 1;
+    }
+    if (recomputeStateHash() != finalHash) {
+        printf("Incremental fingerprint disagrees with a full recomputation (%016llx)\n", (unsigned long long)recomputeStateHash());
+        status = 1;
+    }
+    free(latencies);
+    free(sessions);
+    free(tokens);
+    return status;
+}
+
+// Main function: Drives the bank management system.
+// Without arguments it runs one interactive session on stdin/stdout.
+// With "--serve <port> [--threads <n>]" it serves many sessions over TCP instead.
+// "--replica <name>" publishes the book to shared memory, and "--report <name> <query>"
+// runs a reporting process against such a replica. "--wal <dir>" logs every change to
+// <dir>/bank.wal, and "--standby <dir>" follows that log as a hot standby.
+// "--record <file>" records the input for "--replay <file> [--paced]".
+// "--diff <a> <b>" compares two snapshots or replicas and exits.
+int main(int argc, char *argv[]) {
+    int servePort = 0;  // TCP port to serve on (0 = interactive console)
+    int threads = 1;    // Worker threads in server mode
+    const char *replicaArg = NULL;           // Shared memory name to publish to
+    uint32_t replicaCapacity = REPLICA_DEFAULT_CAPACITY;
+    const char *walDir = NULL;               // Directory of the write-ahead log
+    int standby = 0;                         // Follow the log instead of writing it
+    const char *recordPath = NULL;           // Recording to write
+    const char *replayPath = NULL;           // Recording to replay
+    int paced = 0;                           // Replay at the recorded pace
+    uint32_t stripes = DEFAULT_STRIPE_COUNT; // Entries of the account lock/version table
+    uint32_t stripePadding = CACHE_LINE_SIZE; // Bytes per entry
+    StoreKind store = STORE_LIST;            // Ordered account store
+    const char *coldPath = NULL;             // Cold store file for idle accounts
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            servePort = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--replica") == 0 && i + 1 < argc) {
+            replicaArg = argv[++i];
+        } else if (strcmp(argv[i], "--replica-capacity") == 0 && i + 1 < argc) {
+            replicaCapacity = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if ((strcmp(argv[i], "--wal") == 0 || strcmp(argv[i], "--standby") == 0) && i + 1 < argc) {
+            standby = strcmp(argv[i], "--standby") == 0;
+            walDir = argv[++i];
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            recordPath = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replayPath = argv[++i];
+        } else if (strcmp(argv[i], "--paced") == 0) {
+            paced = 1;
+        } else if (strcmp(argv[i], "--stripes") == 0 && i + 1 < argc) {
+            stripes = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--stripe-padding") == 0 && i + 1 < argc) {
+            stripePadding = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--store") == 0 && i + 1 < argc && parseStoreKind(argv[i + 1], &store)) {
+            i++;
+        } else if (strcmp(argv[i], "--huge-pages") == 0 && i + 1 < argc && parsePageMode(argv[i + 1], &pageMode)) {
+            i++;
+        } else if (strcmp(argv[i], "--cold-store") == 0 && i + 1 < argc) {
+            coldPath = argv[++i];
+        } else if (strcmp(argv[i], "--cold-after") == 0 && i + 1 < argc) {
+            coldAfter = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--bench-tlb") == 0 && i + 1 < argc) {
+            return benchTlb(atoll(argv[i + 1]));
+        } else if (strcmp(argv[i], "--bench-store") == 0 && i + 1 < argc) {
+            return benchStore(atoll(argv[i + 1]));
+        } else if (strcmp(argv[i], "--bench-stripes") == 0 && i + 1 < argc) {
+            return benchStripes(atoll(argv[i + 1]));
+        } else if (strcmp(argv[i], "--diff") == 0 && i + 2 < argc) {
+            bankOut = stdout;
+            return auditDiff(argv[i + 1], argv[i + 2]);
+        } else if (strcmp(argv[i], "--report") == 0 && i + 2 < argc) {
+            bankOut = stdout;
+            return replicaReport(argv[i + 1], argv[i + 2]);
+        } else {
+            fprintf(stderr, "Usage: %s [--serve <port> [--threads <n>]] [--replica <name> [--replica-capacity <n>]]\n"
+                            "          [--wal <dir> | --standby <dir>] [--record <file> | --replay <file> [--paced]]\n"
+                            "          [--stripes <n>] [--stripe-padding <bytes>] [--store list|skiplist|btree]\n"
+                            "          [--huge-pages none|thp|explicit] [--cold-store <file> [--cold-after <seconds>]]\n"
+                            "       %s --report <name> DISPLAY|LOWBALANCE\n"
+                            "       %s --diff <snapshot|shm:name> <snapshot|shm:name>\n"
+                            "       %s --bench-stripes <updates per thread>\n"
+                            "       %s --bench-store <accounts>\n"
+                            "       %s --bench-tlb <accounts>\n", argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+            return 1;
         }
     }
+    if (threads < 1) {
+        threads = 1;
+    }
+    if (!stripesOpen(stripes, stripePadding) || !storeOpen(store)) {
+        return 1;
+    }
+    if (coldPath != NULL && coldOpen(coldPath) < 0) {
+        return 1;
+    }
+    if (replicaArg != NULL && !replicaOpen(replicaArg, replicaCapacity)) {
+        return 1;
+    }
+
+    bankOut = stdout;
+    char leftover[256] = ""; // Input typed after PROMOTE, handed to the session below
+    if (standby) {
+        if (!runStandby(walDir, leftover, sizeof(leftover))) {
+            freeBank();
+            replicaClose();
+            stripesClose();
+            return 0;
+        }
+    } else if (walDir != NULL && !walRecover(walDir)) {
+        return 1;
+    }
+    if (replayPath != NULL) {
+        int status = replay(replayPath, paced);
+        freeBank();
+        replicaClose();
+        walClose();
+        stripesClose();
+        return status;
+    }
+    if (recordPath != NULL && !recordOpen(recordPath)) {
+        return 1;
+    }
+    if (servePort > 0) {
+        int status = serve(servePort, threads);
+        freeBank();
+        replicaClose();
+        walClose();
+        stripesClose();
+        return status;
+    }
+
+    Session session;
+    memset(&session, 0, sizeof(session));
+    char token[100]; // Buffer for one input token
+
+    // Feed stdin to the session one token at a time until EXIT or end of input
+    SessionStatus status = sessionResume(&session, NULL);
+    char *rest = leftover;
+    int consumed = 0;
+    while (status == SESSION_NEEDS_INPUT && sscanf(rest, "%99s%n", token, &consumed) == 1) {
+        rest += consumed;
+        status = sessionResume(&session, token);
+    }
+    while (status == SESSION_NEEDS_INPUT && scanf("%99s", token) == 1) {
+        status = sessionResume(&session, token);
+    }
 
+    recordClose();
+
+    // Free allocated memory for accounts and recycled numbers before exiting
+    freeBank();
+    replicaClose();
+    walClose();
+    stripesClose();
     return 0; // Program exits successfully
-}
\ No newline at end of file
+}